@@ -0,0 +1,126 @@
+/*
+
+joey vigil
+jovigil
+cse130
+admit.c
+~source file for overload
+control~
+
+*/
+
+#include "admit.h"
+#include "stats.h"
+#include <stdatomic.h>
+
+#define INTERVAL_NS 100000000ull // how long waits must stay above target to count as overload
+
+// private types
+
+/*
+past saturation, letting everything in means every request waits
+behind every other one and they all time out together. so there
+are two kinds of limit, and anything over either one gets a 503
+with Retry-After right away instead of a place in line.
+
+the hard limits are counts shared by every thread: connections
+open, and body bytes in flight (a PUT's Content-Length, or the
+size of the file a GET sends), each one atomic add to take and
+one to give back.
+
+the soft limit is on how long a connection waited in the queue
+between the acceptor and a worker, CoDel style: a queue that
+empties now and then is only absorbing a burst, so a wait is
+only held against it once the shortest wait seen over a whole
+INTERVAL_NS was above target. while that holds, anything that
+waited more than target is shed, so the ones served are the ones
+that can still be served quickly; otherwise only waits over
+INTERVAL_NS or target, whichever is longer, are, so a target
+longer than INTERVAL_NS never sheds more outside overload than
+in it. each worker keeps its own window of waits, so
+judging one takes no lock.
+*/
+
+typedef struct Window {
+    uint64_t ends; // stats_clock() at the end of this interval
+    uint64_t min; // shortest wait seen in it, UINT64_MAX if none
+    bool over; // the last interval's shortest was above target
+} Window;
+
+static int max_conns = 0;
+static off_t max_bytes = 0;
+static uint64_t target = 0; // ns
+static _Atomic int open_conns = 0;
+static _Atomic long long held_bytes = 0;
+static _Thread_local Window win = { 0, UINT64_MAX, false };
+
+// public function defs
+
+// admit_init()
+// waits are timed with stats_clock(), so a
+// target needs it running.
+void admit_init(int conns, size_t bytes, int target_ms) {
+    max_conns = conns;
+    max_bytes = (off_t) bytes;
+    target = (uint64_t) target_ms * 1000000;
+    if (target > 0) {
+        stats_clock_on();
+    }
+}
+
+// admit_conn()
+bool admit_conn(void) {
+    if (max_conns == 0) {
+        return true;
+    }
+    if (atomic_fetch_add_explicit(&open_conns, 1, memory_order_relaxed) >= max_conns) {
+        atomic_fetch_sub_explicit(&open_conns, 1, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+// admit_done()
+void admit_done(void) {
+    if (max_conns > 0) {
+        atomic_fetch_sub_explicit(&open_conns, 1, memory_order_relaxed);
+    }
+}
+
+// admit_late()
+bool admit_late(uint64_t waited) {
+    if (target == 0) {
+        return false;
+    }
+    uint64_t now = stats_clock();
+    if (now >= win.ends) {
+        win.over = win.min != UINT64_MAX && win.min > target;
+        win.min = UINT64_MAX;
+        win.ends = now + INTERVAL_NS;
+    }
+    if (waited < win.min) {
+        win.min = waited;
+    }
+    uint64_t limit = win.over ? target : target > INTERVAL_NS ? target : INTERVAL_NS;
+    return waited > limit;
+}
+
+// admit_bytes()
+bool admit_bytes(off_t n) {
+    if (max_bytes == 0 || n <= 0) {
+        return true;
+    }
+    long long before = atomic_fetch_add_explicit(&held_bytes, n, memory_order_relaxed);
+    if (before > 0 && before + n > max_bytes) {
+        atomic_fetch_sub_explicit(&held_bytes, n, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+// admit_free()
+void admit_free(off_t n) {
+    if (max_bytes > 0 && n > 0) {
+        atomic_fetch_sub_explicit(&held_bytes, n, memory_order_relaxed);
+    }
+}
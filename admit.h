@@ -0,0 +1,60 @@
+/*
+
+joey vigil
+jovigil
+cse130
+admit.h
+~header file for overload
+control~
+
+*/
+
+#ifndef ADMIT_H_INCLUDE_
+#define ADMIT_H_INCLUDE_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// exported functs
+
+// admit_init()
+// sets the limits: at most conns connections
+// open at once, at most bytes of request and
+// response bodies in flight, and connections
+// that waited in line longer than target_ms
+// shed once waits stop dropping below it. 0
+// turns a limit off. call once, before
+// serving; until then everything is admitted.
+void admit_init(int conns, size_t bytes, int target_ms);
+
+// admit_conn()
+// counts a newly accepted connection and
+// returns true, or returns false, counting
+// nothing, if there are already too many.
+bool admit_conn(void);
+
+// admit_done()
+// uncounts a connection admit_conn() let in,
+// once it is closed.
+void admit_done(void);
+
+// admit_late()
+// true if a connection that waited waited ns
+// in line, of this thread's, is to be shed
+// rather than served.
+bool admit_late(uint64_t waited);
+
+// admit_bytes()
+// reserves n bytes of body for a request and
+// returns true, or returns false, reserving
+// nothing, if that would go over the limit.
+// a request is always let in when nothing
+// else is in flight, however large it is.
+bool admit_bytes(off_t n);
+
+// admit_free()
+// gives back n bytes admit_bytes() reserved.
+void admit_free(off_t n);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+
+joey vigil
+jovigil
+cse130
+alog.c
+~source file for the access log~
+
+*/
+
+#include "alog.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define RING_SIZE 2048 // records a thread can have waiting, a power of two
+#define URI_SIZE  64 // uris are at most 63 characters
+#define BATCH     (64 * 1024) // bytes of lines formatted before a write
+#define LINE_SIZE 192 // longest line a record makes
+#define POLL_NS   10000000 // how long the log thread naps when it has caught up
+#define FLUSH_NS  1000000000ull // longest a line waits in the batch
+
+// private types
+
+/*
+each thread that finishes requests gets its own Ring, made on
+first use and never freed. the thread is the ring's only
+producer and the log thread its only consumer, so adding a
+record is a copy into the next slot and a release store of
+head, with no lock or locked instruction. the producer keeps
+its own copy of tail and only reloads it when the ring looks
+full, so in the common case it touches no line the log thread
+writes.
+
+the log thread does all the formatting: every POLL_NS it empties
+each ring into one BATCH sized buffer, and writes the buffer out
+when it's nearly full, or once a line has waited FLUSH_NS, so
+the file sees a few large writes rather than one per request. a
+full ring means the log thread has fallen behind, and the record
+is dropped and counted rather than holding up the request.
+*/
+
+typedef struct Record {
+    uint64_t end; // stats_clock() when the request finished
+    uint64_t took; // ns from its first byte
+    int64_t in;
+    int64_t out;
+    int status;
+    char method[4];
+    char uri[URI_SIZE];
+} Record;
+
+typedef struct Ring {
+    _Alignas(64) _Atomic uint64_t head; // next slot the owner fills
+    uint64_t tail_seen; // owner's last look at tail
+    _Atomic uint64_t dropped; // records the owner couldn't fit
+    _Alignas(64) _Atomic uint64_t tail; // next slot the log thread reads
+    Record recs[RING_SIZE];
+    struct Ring *next; // on the list of every thread's
+} Ring;
+
+static bool on = false; // set once, before any worker starts
+static pthread_mutex_t all_lock = PTHREAD_MUTEX_INITIALIZER;
+static Ring *all = NULL;
+static _Thread_local Ring *mine = NULL;
+static int log_fd = -1;
+static int64_t wall_offset = 0; // realtime minus stats_clock(), in ns
+
+// private functions
+
+// get_ring()
+// this thread's Ring, made and put on the
+// list on first use. NULL if out of memory.
+static Ring *get_ring(void) {
+    if (mine == NULL) {
+        Ring *r = aligned_alloc(64, sizeof(Ring));
+        if (r == NULL) {
+            return NULL;
+        }
+        memset(r, 0, sizeof(Ring));
+        pthread_mutex_lock(&all_lock);
+        r->next = all;
+        all = r;
+        pthread_mutex_unlock(&all_lock);
+        mine = r;
+    }
+    return mine;
+}
+
+// write_all()
+// writes all n bytes of buf to log_fd, or
+// gives up on the first error.
+static void write_all(const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(log_fd, buf, n);
+        if (w <= 0) {
+            return;
+        }
+        buf += w;
+        n -= w;
+    }
+}
+
+// format()
+// writes rec's line to buf, which has room
+// for LINE_SIZE bytes, and returns its length.
+// the time is kept in stamp, which is only
+// remade when the second changes.
+static int format(char *buf, const Record *rec, char *stamp, time_t *stamp_sec) {
+    int64_t wall = (int64_t) rec->end + wall_offset;
+    time_t sec = wall / 1000000000;
+    if (sec != *stamp_sec) {
+        struct tm tm;
+        gmtime_r(&sec, &tm);
+        strftime(stamp, 24, "%Y-%m-%dT%H:%M:%S", &tm);
+        *stamp_sec = sec;
+    }
+    return snprintf(buf, LINE_SIZE, "%s.%03dZ %s %s%s %d %lld %lld %.6f\n", stamp,
+        (int) (wall % 1000000000 / 1000000), rec->method[0] ? rec->method : "-",
+        rec->uri[0] ? "/" : "-", rec->uri, rec->status, (long long) rec->in, (long long) rec->out,
+        rec->took / 1e9);
+}
+
+// run_log()
+// the log thread. empties every ring into
+// its batch, forever.
+static void *run_log(void *arg) {
+    (void) arg;
+    char *batch = malloc(BATCH);
+    if (batch == NULL) {
+        return NULL;
+    }
+    size_t len = 0;
+    char stamp[24] = "";
+    time_t stamp_sec = -1;
+    uint64_t reported = 0; // drops already noted in the log
+    uint64_t last_write = stats_clock();
+    while (1) {
+        bool behind = false;
+        uint64_t dropped = 0;
+        pthread_mutex_lock(&all_lock);
+        Ring *r = all;
+        pthread_mutex_unlock(&all_lock); // the list only ever grows at its head
+        for (; r != NULL; r = r->next) {
+            uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+            behind |= head - tail > RING_SIZE / 2;
+            for (; tail != head; tail++) {
+                if (BATCH - len < LINE_SIZE) {
+                    write_all(batch, len);
+                    len = 0;
+                    last_write = stats_clock();
+                }
+                len += format(batch + len, &r->recs[tail & (RING_SIZE - 1)], stamp, &stamp_sec);
+            }
+            atomic_store_explicit(&r->tail, tail, memory_order_release);
+            dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        }
+        if (dropped != reported && BATCH - len >= LINE_SIZE) {
+            len += snprintf(batch + len, LINE_SIZE, "# dropped %llu records\n",
+                (unsigned long long) (dropped - reported));
+            reported = dropped;
+        }
+        uint64_t now = stats_clock();
+        if (len > 0 && (len > BATCH / 2 || now - last_write >= FLUSH_NS)) {
+            write_all(batch, len);
+            len = 0;
+            last_write = now;
+        }
+        if (!behind) {
+            struct timespec nap = { .tv_sec = 0, .tv_nsec = POLL_NS };
+            nanosleep(&nap, NULL);
+        }
+    }
+    return NULL;
+}
+
+// public function defs
+
+// alog_init()
+// the log needs the clock running to time
+// requests, even if nothing else is counted.
+bool alog_init(const char *path) {
+    int fd = strcmp(path, "-") == 0
+                 ? dup(STDOUT_FILENO)
+                 : open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    stats_clock_on();
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wall_offset = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec - (int64_t) stats_clock();
+    log_fd = fd;
+    on = true;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, run_log, NULL) != 0) {
+        on = false;
+        close(fd);
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+// alog_request()
+void alog_request(const char *method, const char *uri, int status, off_t in, off_t out,
+    uint64_t start, uint64_t end) {
+    Ring *r = on ? get_ring() : NULL;
+    if (r == NULL) {
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - r->tail_seen == RING_SIZE) {
+        r->tail_seen = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head - r->tail_seen == RING_SIZE) {
+            atomic_store_explicit(&r->dropped,
+                atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+                memory_order_relaxed);
+            return;
+        }
+    }
+    Record *rec = &r->recs[head & (RING_SIZE - 1)];
+    rec->end = end;
+    rec->took = end > start ? end - start : 0;
+    rec->in = in;
+    rec->out = out;
+    rec->status = status;
+    strncpy(rec->method, method, sizeof(rec->method) - 1);
+    rec->method[sizeof(rec->method) - 1] = '\0';
+    strncpy(rec->uri, uri, URI_SIZE - 1);
+    rec->uri[URI_SIZE - 1] = '\0';
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
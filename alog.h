@@ -0,0 +1,38 @@
+/*
+
+joey vigil
+jovigil
+cse130
+alog.h
+~header file for the access log~
+
+*/
+
+#ifndef ALOG_H_INCLUDE_
+#define ALOG_H_INCLUDE_
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// exported functs
+
+// alog_init()
+// appends a line per request to the file at
+// path, or to stdout if path is "-", from a
+// thread of its own. call once, before
+// serving. returns false if the file can't
+// be opened. until it succeeds, alog_request()
+// does nothing.
+bool alog_init(const char *path);
+
+// alog_request()
+// logs one finished request: its method and
+// uri ("" if it never got that far), status,
+// bytes taken in and sent, and the
+// stats_clock() times of its first byte and
+// its end. never blocks; if the log can't
+// keep up the record is dropped and counted.
+void alog_request(const char *method, const char *uri, int status, off_t in, off_t out,
+    uint64_t start, uint64_t end);
+
+#endif
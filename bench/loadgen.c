@@ -0,0 +1,721 @@
+/*
+
+joey vigil
+jovigil
+cse130
+loadgen.c
+~load generator for benchmarking
+httpserver over localhost~
+
+*/
+
+#define _GNU_SOURCE // memmem, strcasestr
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#define USAGE                                                                                      \
+    "Usage:\n./loadgen [-c conns] [-t threads] [-d secs] [-w warmup_secs] [-r rate] "              \
+    "[-m put_pct] [-s size[:weight],...] [-n objects] [-k] [-j] <port>"
+#define CLASSES_MAX 16 // object size classes in -s
+#define RBUF        16384 // response bytes read per call, headers must fit
+#define PENDING_MAX (1 << 16) // open-loop requests waiting for a connection, per thread
+#define SUB_BITS    4 // latency buckets per power of two, as in the server's stats
+#define SUBS        (1 << SUB_BITS)
+#define TOP_BITS    40
+#define NBUCKETS    ((TOP_BITS - SUB_BITS + 1) * SUBS)
+#define NS          1000000000ull
+
+// private types
+
+// what the run looks like, from the command line
+typedef struct Config {
+    int port;
+    int conns;
+    int threads;
+    int secs;
+    int warmup;
+    double rate; // requests per second in all, 0 for closed loop
+    int put_pct;
+    int nclasses;
+    size_t sizes[CLASSES_MAX];
+    int weights[CLASSES_MAX];
+    int weight_sum;
+    int objects; // per size class
+    const char *spec; // the size classes as given
+    bool keep_alive;
+    bool json;
+} Config;
+
+// what one thread saw, summed by main() at the end
+typedef struct Tally {
+    uint64_t buckets[NBUCKETS]; // latency of measured requests
+    uint64_t done; // requests measured
+    uint64_t lat_sum; // ns
+    uint64_t lat_max;
+    uint64_t non2xx;
+    uint64_t errors; // connections that failed mid-request
+    uint64_t dropped; // open-loop requests pushed out of a full wait queue
+    uint64_t rx; // bytes received for measured requests
+    uint64_t tx; // and sent
+} Tally;
+
+enum connStates { C_FREE, C_CONNECTING, C_SEND, C_RECV };
+
+typedef struct Conn {
+    int fd; // -1 while closed
+    int state;
+    uint32_t events; // what epoll is watching fd for
+    uint64_t start; // when the request was due
+    char req[160];
+    size_t req_len;
+    size_t body_len;
+    size_t sent; // of req and body
+    char buf[RBUF];
+    size_t got; // header bytes in buf
+    long long need; // body bytes still to come, -1 until the header is in
+    int status;
+    bool closing; // the server said Connection: close
+    uint64_t rx; // bytes this request has moved so far
+    uint64_t tx;
+} Conn;
+
+typedef struct Worker {
+    int id;
+    int nconns;
+    Conn *conns;
+    Tally t;
+} Worker;
+
+static Config cfg = { .conns = 16, .threads = 1, .secs = 10, .put_pct = 0, .objects = 16,
+    .keep_alive = true };
+static char *pattern; // body bytes every PUT sends
+static uint64_t t_measure; // requests due before this are warmup
+static uint64_t t_end;
+
+// private functions
+
+// now_ns()
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * NS + t.tv_nsec;
+}
+
+// bucket()
+// the latency bucket v ns falls in.
+static int bucket(uint64_t v) {
+    if (v < SUBS) {
+        return (int) v;
+    }
+    if (v >> TOP_BITS) {
+        v = (1ull << TOP_BITS) - 1;
+    }
+    int m = 63 - __builtin_clzll(v);
+    return (m - SUB_BITS + 1) * SUBS + (int) ((v >> (m - SUB_BITS)) - SUBS);
+}
+
+// bucket_top()
+// the largest value that falls in bucket i.
+static uint64_t bucket_top(int i) {
+    if (i < SUBS) {
+        return i;
+    }
+    int shift = i / SUBS - 1;
+    return ((uint64_t) (SUBS + i % SUBS) << shift) + (1ull << shift) - 1;
+}
+
+// quantile()
+// the latency below which q of the measured
+// requests in t fell, in ns.
+static uint64_t quantile(const Tally *t, double q) {
+    if (t->done == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (q * t->done + 0.999999), seen = 0;
+    int i = 0;
+    while ((seen += t->buckets[i]) < rank) {
+        i++;
+    }
+    uint64_t v = bucket_top(i);
+    return v < t->lat_max ? v : t->lat_max;
+}
+
+// parse_size()
+// reads a byte count like 4096, 64K or 1M,
+// stopping at end. returns 0 if it isn't one.
+static size_t parse_size(const char *str, char **end) {
+    unsigned long long n = strtoull(str, end, 10);
+    if (*end == str) {
+        return 0;
+    }
+    switch (**end) {
+    case 'G': n <<= 10; // fall through
+    case 'M': n <<= 10; // fall through
+    case 'K': n <<= 10; (*end)++; break;
+    }
+    return n;
+}
+
+// parse_sizes()
+// fills in cfg's size classes from a list
+// like "1K:6,64K:3,1M". a missing weight is
+// 1. returns false if spec isn't one.
+static bool parse_sizes(const char *spec) {
+    const char *p = spec;
+    cfg.nclasses = cfg.weight_sum = 0;
+    while (*p != '\0' && cfg.nclasses < CLASSES_MAX) {
+        char *end;
+        size_t size = parse_size(p, &end);
+        int weight = 1;
+        if (*end == ':') {
+            weight = strtol(end + 1, &end, 10);
+        }
+        if (size == 0 || weight < 1 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        cfg.sizes[cfg.nclasses] = size;
+        cfg.weights[cfg.nclasses++] = weight;
+        cfg.spec = spec;
+        cfg.weight_sum += weight;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return cfg.nclasses > 0 && *p == '\0';
+}
+
+// put_request()
+// writes the header of a request for object
+// k of class c to buf and returns its length.
+static int put_request(char *buf, size_t room, bool put, int c, int k, bool keep_alive) {
+    char length[48] = "";
+    if (put) {
+        snprintf(length, sizeof(length), "Content-Length: %zu\r\n", cfg.sizes[c]);
+    }
+    return snprintf(buf, room, "%s /lg-%d-%d.bin HTTP/1.1\r\n%s%s\r\n", put ? "PUT" : "GET", c,
+        k, length, keep_alive ? "" : "Connection: close\r\n");
+}
+
+// send_all()
+// blocking write of n bytes, for setup.
+static bool send_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, buf, n, MSG_NOSIGNAL);
+        if (w <= 0) {
+            return false;
+        }
+        buf += w;
+        n -= w;
+    }
+    return true;
+}
+
+// connect_to()
+// a socket connecting to the server on
+// localhost, non-blocking if asked. -1 if
+// it can't be made.
+static int connect_to(bool nonblock) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (nonblock ? SOCK_NONBLOCK : 0), 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(cfg.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// setup()
+// PUTs every object once, over one blocking
+// connection, so GETs have something to
+// fetch. returns false if any PUT fails.
+static bool setup(void) {
+    int fd = connect_to(false);
+    if (fd < 0) {
+        warn("Cannot connect to port %d", cfg.port);
+        return false;
+    }
+    char buf[RBUF];
+    for (int c = 0; c < cfg.nclasses; c++) {
+        for (int k = 0; k < cfg.objects; k++) {
+            int len = put_request(buf, sizeof(buf), true, c, k, true);
+            if (!send_all(fd, buf, len) || !send_all(fd, pattern, cfg.sizes[c])) {
+                close(fd);
+                return false;
+            }
+            size_t got = 0;
+            char *end = NULL;
+            while (end == NULL) {
+                ssize_t n = recv(fd, buf + got, sizeof(buf) - 1 - got, 0);
+                if (n <= 0) {
+                    close(fd);
+                    return false;
+                }
+                got += n;
+                buf[got] = '\0';
+                end = strstr(buf, "\r\n\r\n");
+            }
+            char *cl = strcasestr(buf, "Content-Length:");
+            long long need = cl != NULL ? atoll(cl + 15) : 0;
+            need -= got - (end + 4 - buf);
+            while (need > 0) { // the short reason phrase
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    close(fd);
+                    return false;
+                }
+                need -= n;
+            }
+            if (strncmp(buf + 9, "200", 3) != 0 && strncmp(buf + 9, "201", 3) != 0) {
+                warnx("PUT /lg-%d-%d.bin got %.3s", c, k, buf + 9);
+                close(fd);
+                return false;
+            }
+        }
+    }
+    close(fd);
+    return true;
+}
+
+// watch()
+// points epoll at fd for events, if it isn't
+// already.
+static void watch(int ep, Conn *c, uint32_t events) {
+    if (c->events == events) {
+        return;
+    }
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(ep, c->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+// drop()
+// closes c's connection.
+static void drop(Conn *c) {
+    if (c->fd >= 0) {
+        close(c->fd); // leaves epoll with it
+    }
+    c->fd = -1;
+    c->events = 0;
+}
+
+// send_more()
+// sends what it can of c's request. returns
+// false if the connection failed.
+static bool send_more(int ep, Conn *c) {
+    while (c->sent < c->req_len + c->body_len) {
+        struct iovec iov[2];
+        int cnt = 0;
+        if (c->sent < c->req_len) {
+            iov[cnt++] = (struct iovec) { c->req + c->sent, c->req_len - c->sent };
+        }
+        size_t boff = c->sent > c->req_len ? c->sent - c->req_len : 0;
+        if (boff < c->body_len) {
+            iov[cnt++] = (struct iovec) { pattern + boff, c->body_len - boff };
+        }
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = cnt };
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watch(ep, c, EPOLLOUT);
+            return true;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        c->sent += n;
+        c->tx += n;
+    }
+    c->state = C_RECV;
+    c->got = 0;
+    c->need = -1;
+    watch(ep, c, EPOLLIN);
+    return true;
+}
+
+// issue()
+// starts a request due at start on free
+// connection c, connecting first if it has
+// to.
+static bool issue(int ep, Conn *c, uint64_t start, unsigned *seed) {
+    bool put = (int) (rand_r(seed) % 100) < cfg.put_pct;
+    int pick = rand_r(seed) % cfg.weight_sum, cls = 0;
+    while (pick >= cfg.weights[cls]) {
+        pick -= cfg.weights[cls++];
+    }
+    int k = rand_r(seed) % cfg.objects;
+    c->req_len = put_request(c->req, sizeof(c->req), put, cls, k, cfg.keep_alive);
+    c->body_len = put ? cfg.sizes[cls] : 0;
+    c->sent = 0;
+    c->start = start;
+    c->closing = false;
+    c->rx = c->tx = 0;
+    if (c->fd < 0) {
+        c->fd = connect_to(true);
+        if (c->fd < 0) {
+            return false;
+        }
+        c->state = C_CONNECTING;
+        watch(ep, c, EPOLLOUT);
+        return true;
+    }
+    c->state = C_SEND;
+    return send_more(ep, c);
+}
+
+// finish()
+// tallies c's request, now that its response
+// is all in.
+static void finish(Worker *w, Conn *c) {
+    uint64_t now = now_ns();
+    if (c->start >= t_measure && now <= t_end) {
+        uint64_t lat = now - c->start;
+        w->t.buckets[bucket(lat)]++;
+        w->t.done++;
+        w->t.lat_sum += lat;
+        if (lat > w->t.lat_max) {
+            w->t.lat_max = lat;
+        }
+        if (c->status < 200 || c->status > 299) {
+            w->t.non2xx++;
+        }
+        w->t.rx += c->rx;
+        w->t.tx += c->tx;
+    }
+    if (!cfg.keep_alive || c->closing) {
+        drop(c);
+    }
+    c->state = C_FREE;
+}
+
+// recv_more()
+// reads what it can of c's response. returns
+// 1 once it is all in, 0 if more is to come,
+// or -1 if the connection failed.
+static int recv_more(Conn *c) {
+    while (1) {
+        char sink[RBUF];
+        bool head = c->need < 0;
+        ssize_t n = head ? recv(c->fd, c->buf + c->got, RBUF - 1 - c->got, 0)
+                         : recv(c->fd, sink, c->need < RBUF ? c->need : RBUF, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->rx += n;
+        if (!head) {
+            c->need -= n;
+            if (c->need == 0) {
+                return 1;
+            }
+            continue;
+        }
+        c->got += n;
+        c->buf[c->got] = '\0';
+        char *end = memmem(c->buf, c->got, "\r\n\r\n", 4);
+        if (end == NULL) {
+            if (c->got == RBUF - 1) {
+                return -1;
+            }
+            continue;
+        }
+        c->status = atoi(c->buf + 9);
+        *end = '\0'; // keep the searches in the header
+        char *cl = strcasestr(c->buf, "Content-Length:");
+        c->closing = strcasestr(c->buf, "Connection: close") != NULL;
+        c->need = (cl != NULL ? atoll(cl + 15) : 0) - (long long) (c->got - (end + 4 - c->buf));
+        if (c->need <= 0) {
+            return 1;
+        }
+    }
+}
+
+// run()
+// a worker thread: drives its connections
+// from one epoll until the run is over.
+// closed loop starts each connection's next
+// request as soon as its last is answered;
+// open loop starts them at evenly spaced
+// times, and one due while every connection
+// is busy waits for the next to come free,
+// with the wait counted in its latency.
+static void *run(void *arg) {
+    Worker *w = (Worker *) arg;
+    unsigned seed = 0x9e3779b9u * (w->id + 1);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    double rate = cfg.rate / cfg.threads;
+    bool open_loop = rate > 0;
+    uint64_t gap = open_loop ? (uint64_t) (NS / rate) : 0;
+    uint64_t next_due = now_ns();
+    uint64_t *pending = open_loop ? malloc(PENDING_MAX * sizeof(uint64_t)) : NULL;
+    size_t p_head = 0, p_tail = 0; // pending[] is a ring
+    Conn **free_conns = malloc(w->nconns * sizeof(Conn *));
+    int nfree = 0;
+
+    // open loop wakes for each due time on a timer
+    int tfd = -1;
+    if (open_loop) {
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+        epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev);
+    }
+    for (int i = 0; i < w->nconns; i++) {
+        Conn *c = &w->conns[i];
+        c->fd = -1;
+        c->events = 0;
+        c->state = C_FREE;
+        if (open_loop) {
+            free_conns[nfree++] = c;
+        } else if (!issue(ep, c, next_due, &seed)) { // the server is gone
+            w->t.errors++;
+            drop(c);
+        }
+    }
+
+    struct epoll_event evs[256];
+    uint64_t now = now_ns();
+    while (now < t_end) {
+        if (open_loop) {
+            for (; next_due <= now; next_due += gap) {
+                if (nfree > 0) {
+                    Conn *c = free_conns[--nfree];
+                    if (!issue(ep, c, next_due, &seed)) {
+                        w->t.errors++;
+                        drop(c);
+                        free_conns[nfree++] = c;
+                    }
+                } else {
+                    if (p_tail - p_head == PENDING_MAX) { // overloaded, give up the oldest
+                        p_head++;
+                        w->t.dropped++;
+                    }
+                    pending[p_tail++ % PENDING_MAX] = next_due;
+                }
+            }
+            struct itimerspec its = { .it_value = { next_due / NS, next_due % NS } };
+            timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+        }
+        uint64_t left_ms = (t_end - now) / 1000000 + 1;
+        int n = epoll_wait(ep, evs, 256, open_loop ? (int) left_ms : 100);
+        for (int i = 0; i < n; i++) {
+            Conn *c = (Conn *) evs[i].data.ptr;
+            if (c == NULL) { // the timer, due times are handled at the top
+                uint64_t ticks;
+                ssize_t got = read(tfd, &ticks, sizeof(ticks));
+                (void) got;
+                continue;
+            }
+            int r = 0;
+            if (c->state == C_CONNECTING) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                c->state = C_SEND;
+                r = (err == 0 && send_more(ep, c)) ? 0 : -1;
+            } else if (c->state == C_SEND) {
+                r = send_more(ep, c) ? 0 : -1;
+            } else if (c->state == C_RECV) {
+                r = recv_more(c);
+            } else { // the server hung up on an idle connection
+                drop(c);
+                continue;
+            }
+            if (r == 0) {
+                continue;
+            }
+            if (r < 0) {
+                if (c->start >= t_measure) {
+                    w->t.errors++;
+                }
+                drop(c);
+                c->state = C_FREE;
+            } else {
+                finish(w, c);
+            }
+
+            // hand the connection its next request
+            bool ok = true;
+            if (!open_loop) {
+                ok = issue(ep, c, now_ns(), &seed);
+            } else if (p_head < p_tail) {
+                ok = issue(ep, c, pending[p_head++ % PENDING_MAX], &seed);
+            } else {
+                free_conns[nfree++] = c;
+            }
+            if (!ok) {
+                w->t.errors++;
+                drop(c);
+                c->state = C_FREE;
+                if (open_loop) {
+                    free_conns[nfree++] = c;
+                }
+            }
+        }
+        now = now_ns();
+    }
+
+    // requests still out when time ran out aren't counted
+    for (int i = 0; i < w->nconns; i++) {
+        drop(&w->conns[i]);
+    }
+    if (tfd >= 0) {
+        close(tfd);
+    }
+    close(ep);
+    free(pending);
+    free(free_conns);
+    return NULL;
+}
+
+// report()
+// prints the totals in t, as one line of
+// JSON or for people.
+static void report(const Tally *t) {
+    double secs = cfg.secs;
+    double us = 1e3;
+    const char *mode = cfg.rate > 0 ? "open" : "closed";
+    if (cfg.json) {
+        printf("{\"mode\":\"%s\",\"conns\":%d,\"threads\":%d,\"secs\":%d,\"rate\":%.0f,"
+               "\"put_pct\":%d,\"sizes\":\"%s\",\"objects\":%d,\"keep_alive\":%s,\"requests\":%llu,\"rps\":%.1f,"
+               "\"non2xx\":%llu,\"errors\":%llu,\"dropped\":%llu,\"mean_us\":%.1f,"
+               "\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,"
+               "\"max_us\":%.1f,\"rx_bytes\":%llu,\"tx_bytes\":%llu}\n",
+            mode, cfg.conns, cfg.threads, cfg.secs, cfg.rate, cfg.put_pct, cfg.spec, cfg.objects,
+            cfg.keep_alive ? "true" : "false", (unsigned long long) t->done, t->done / secs,
+            (unsigned long long) t->non2xx, (unsigned long long) t->errors,
+            (unsigned long long) t->dropped, t->done ? t->lat_sum / us / t->done : 0,
+            quantile(t, 0.5) / us, quantile(t, 0.9) / us, quantile(t, 0.99) / us,
+            quantile(t, 0.999) / us, t->lat_max / us, (unsigned long long) t->rx,
+            (unsigned long long) t->tx);
+        return;
+    }
+    printf("%s loop, %d conns on %d threads, %d s, %d%% PUT of %s x %d, keep-alive %s\n", mode,
+        cfg.conns, cfg.threads, cfg.secs, cfg.put_pct, cfg.spec, cfg.objects,
+        cfg.keep_alive ? "on" : "off");
+    printf("requests %llu (%.1f/s", (unsigned long long) t->done, t->done / secs);
+    if (cfg.rate > 0) {
+        printf(" of %.0f/s asked", cfg.rate);
+    }
+    printf("), non-2xx %llu, errors %llu, dropped %llu\n", (unsigned long long) t->non2xx,
+        (unsigned long long) t->errors, (unsigned long long) t->dropped);
+    printf("latency us: mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+        t->done ? t->lat_sum / us / t->done : 0, quantile(t, 0.5) / us, quantile(t, 0.9) / us,
+        quantile(t, 0.99) / us, quantile(t, 0.999) / us, t->lat_max / us);
+    printf("received %.1f MB/s, sent %.1f MB/s\n", t->rx / secs / 1e6, t->tx / secs / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    if (!parse_sizes("4K")) {
+        return EXIT_FAILURE;
+    }
+    while ((opt = getopt(argc, argv, "c:t:d:w:r:m:s:n:kj")) != -1) {
+        switch (opt) {
+        case 'c': cfg.conns = atoi(optarg); break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'd': cfg.secs = atoi(optarg); break;
+        case 'w': cfg.warmup = atoi(optarg); break;
+        case 'r': cfg.rate = atof(optarg); break;
+        case 'm': cfg.put_pct = atoi(optarg); break;
+        case 's':
+            if (!parse_sizes(optarg)) {
+                warnx("Invalid size list");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n': cfg.objects = atoi(optarg); break;
+        case 'k': cfg.keep_alive = false; break;
+        case 'j': cfg.json = true; break;
+        default: warnx(USAGE); exit(EXIT_FAILURE);
+        }
+    }
+    if (optind == argc - 1) {
+        cfg.port = atoi(argv[optind]);
+    }
+    if (cfg.port < 1 || cfg.port > 65535 || cfg.conns < 1 || cfg.threads < 1
+        || cfg.threads > cfg.conns || cfg.secs < 1 || cfg.warmup < 0 || cfg.rate < 0
+        || cfg.put_pct < 0 || cfg.put_pct > 100 || cfg.objects < 1) {
+        warnx(USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t biggest = 0;
+    for (int c = 0; c < cfg.nclasses; c++) {
+        biggest = cfg.sizes[c] > biggest ? cfg.sizes[c] : biggest;
+    }
+    pattern = malloc(biggest);
+    if (pattern == NULL) {
+        warnx("Cannot allocate %zu bytes of body", biggest);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < biggest; i++) {
+        pattern[i] = 'a' + i % 26;
+    }
+    if (!setup()) {
+        warnx("Cannot create the objects on port %d", cfg.port);
+        exit(EXIT_FAILURE);
+    }
+
+    // connections are split as evenly as they go
+    Worker *ws = calloc(cfg.threads, sizeof(Worker));
+    Conn *conns = calloc(cfg.conns, sizeof(Conn));
+    pthread_t *tids = calloc(cfg.threads, sizeof(pthread_t));
+    uint64_t t0 = now_ns();
+    t_measure = t0 + (uint64_t) cfg.warmup * NS;
+    t_end = t_measure + (uint64_t) cfg.secs * NS;
+    for (int i = 0, at = 0; i < cfg.threads; i++) {
+        ws[i].id = i;
+        ws[i].nconns = cfg.conns / cfg.threads + (i < cfg.conns % cfg.threads);
+        ws[i].conns = conns + at;
+        at += ws[i].nconns;
+        if (pthread_create(&tids[i], NULL, run, &ws[i]) != 0) {
+            warnx("Cannot create worker thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Tally *sum = calloc(1, sizeof(Tally));
+    for (int i = 0; i < cfg.threads; i++) {
+        pthread_join(tids[i], NULL);
+        Tally *t = &ws[i].t;
+        for (int b = 0; b < NBUCKETS; b++) {
+            sum->buckets[b] += t->buckets[b];
+        }
+        sum->done += t->done;
+        sum->lat_sum += t->lat_sum;
+        sum->lat_max = t->lat_max > sum->lat_max ? t->lat_max : sum->lat_max;
+        sum->non2xx += t->non2xx;
+        sum->errors += t->errors;
+        sum->dropped += t->dropped;
+        sum->rx += t->rx;
+        sum->tx += t->tx;
+    }
+    report(sum);
+
+    free(sum);
+    free(tids);
+    free(conns);
+    free(ws);
+    free(pattern);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,350 @@
+/*
+
+joey vigil
+jovigil
+cse130
+parsebench.c
+~microbenchmark for parse_request()
+against the regex parser~
+
+*/
+
+#include "../parse.h"
+#include "../scan.h"
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define BUDGET_MS 300 // time spent per request per parser
+#define BATCH     16 // parses between clock reads
+#define PIPELINE  8 // requests in the pipelined batch
+#define CASES_MAX 48
+
+// allocation counting
+
+/*
+the bench replaces malloc and friends with wrappers that count
+calls and hand off to glibc's own allocator, so allocations made
+anywhere (including inside regcomp/regexec) are seen. it is
+single threaded, so a plain counter does.
+*/
+
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t n);
+extern void __libc_free(void *p);
+
+static unsigned long allocs = 0;
+
+void *malloc(size_t n) {
+    allocs++;
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+    allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+    allocs++;
+    return __libc_realloc(p, n);
+}
+
+void free(void *p) {
+    __libc_free(p);
+}
+
+// the corpus
+
+// one buffer's worth of header bytes, holding
+// reqs requests back to back
+typedef struct Case {
+    const char *name;
+    char *text;
+    int reqs;
+} Case;
+
+static Case cases[CASES_MAX];
+static int ncases = 0;
+
+// add()
+// puts a copy of text in the corpus.
+static void add(const char *name, const char *text, int reqs) {
+    cases[ncases].name = name;
+    cases[ncases].text = strdup(text);
+    cases[ncases].reqs = reqs;
+    ncases++;
+}
+
+// add_fmt()
+// puts a header in the corpus whose one
+// header line has a key of key_len and a
+// value of val_len bytes, or, if lines is
+// set, lines short header lines instead.
+static void add_fmt(const char *name, int key_len, int val_len, int lines) {
+    char buf[BUF_SIZE];
+    int n = snprintf(buf, sizeof(buf), "GET /index.html HTTP/1.1\r\n");
+    if (lines > 0) {
+        for (int i = 0; i < lines && n < BUF_SIZE - 32; i++) {
+            n += snprintf(buf + n, sizeof(buf) - n, "X-H%03d: v\r\n", i);
+        }
+    } else {
+        memset(buf + n, 'k', key_len);
+        n += key_len;
+        n += snprintf(buf + n, sizeof(buf) - n, ": ");
+        memset(buf + n, 'v', val_len);
+        n += val_len;
+        n += snprintf(buf + n, sizeof(buf) - n, "\r\n");
+    }
+    snprintf(buf + n, sizeof(buf) - n, "\r\n");
+    add(name, buf, 1);
+}
+
+// build_corpus()
+// the shapes of header we actually see, then
+// ones an attacker or a broken client sends:
+// every length limit, on and just past it,
+// more lines than the scanner remembers,
+// malformed request lines, and a pipelined
+// batch.
+static void build_corpus(void) {
+    add("get", "GET /index.html HTTP/1.1\r\n\r\n", 1);
+    add("put", "PUT /upload.bin HTTP/1.1\r\nContent-Length: 1048576\r\n\r\n", 1);
+    add("curl",
+        "GET /data.json HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: curl/7.88.1\r\n"
+        "Accept: */*\r\n\r\n",
+        1);
+    add("browser",
+        "GET /app.js HTTP/1.1\r\nHost: example.com\r\nUser-Agent: Mozilla/5.0 (X11; Linux "
+        "x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\nAccept: "
+        "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\nAccept-Language: "
+        "en-US,en;q=0.5\r\nAccept-Encoding: gzip, deflate, br\r\nReferer: "
+        "http://example.com/index.html\r\nConnection: keep-alive\r\nCache-Control: no-cache\r\n"
+        "Pragma: no-cache\r\nSec-Fetch-Dest: script\r\nSec-Fetch-Mode: no-cors\r\n\r\n",
+        1);
+    add("delete", "DELETE /x HTTP/1.1\r\n\r\n", 1);
+    add("http10", "GET /x HTTP/1.0\r\n\r\n", 1);
+    add("bad-line", "GET /x HTTP/1.1\r\nbad header\r\n\r\n", 1);
+
+    // our clients' 1-4 KB of cookies and tracing
+    char big[4096];
+    int n = snprintf(big, sizeof(big), "GET /feed.json HTTP/1.1\r\nHost: example.com\r\n");
+    for (int i = 0; i < 24; i++) {
+        n += snprintf(big + n, sizeof(big) - n, "X-Trace-%02d: ", i);
+        for (int j = 0; j < 110; j++) {
+            big[n++] = 'a' + (i + j) % 26;
+        }
+        n += snprintf(big + n, sizeof(big) - n, "\r\n");
+    }
+    snprintf(big + n, sizeof(big) - n, "\r\n");
+    add("cookies", big, 1);
+
+    // limits: keys and values are 1-128 bytes, uris 1-63,
+    // methods 1-8 letters, and the scanner keeps MAX_LINES
+    add_fmt("key-128", 128, 8, 0);
+    add_fmt("key-129", 129, 8, 0);
+    add_fmt("val-128", 8, 128, 0);
+    add_fmt("val-129", 8, 129, 0);
+    add_fmt("lines-200", 0, 0, 200);
+    add_fmt("lines-400", 0, 0, MAX_LINES + 144);
+    char uri[128];
+    snprintf(uri, sizeof(uri), "GET /%063d HTTP/1.1\r\n\r\n", 0);
+    add("uri-63", uri, 1);
+    snprintf(uri, sizeof(uri), "GET /%064d HTTP/1.1\r\n\r\n", 0);
+    add("uri-64", uri, 1);
+    add("method-9", "GETTINGIT /x HTTP/1.1\r\n\r\n", 1);
+
+    // malformed
+    add("no-version", "GET /x\r\n\r\n", 1);
+    add("bare-lf", "GET /x HTTP/1.1\nHost: a\n\n", 1);
+    add("two-spaces", "GET  /x HTTP/1.1\r\n\r\n", 1);
+    add("no-slash", "GET x HTTP/1.1\r\n\r\n", 1);
+    add("no-space", "GET /x HTTP/1.1\r\nHost:a\r\n\r\n", 1);
+    add("ctl-value", "GET /x HTTP/1.1\r\nHost: a\tb\r\n\r\n", 1);
+    add("empty-val", "GET /x HTTP/1.1\r\nHost: \r\n\r\n", 1);
+    add("truncated", "GET /x HTTP/1.1\r\nHost: a", 1);
+    add("neg-length", "PUT /x HTTP/1.1\r\nContent-Length: -5\r\n\r\n", 1);
+    add("no-length", "PUT /x HTTP/1.1\r\n\r\n", 1);
+    add("chunk-get", "GET /x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", 1);
+    add("gzip-put", "PUT /x HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", 1);
+
+    // keep-alive clients that don't wait for each answer
+    char batch[BUF_SIZE] = "";
+    for (int i = 0; i < PIPELINE; i++) {
+        strcat(batch, cases[i % 4].text);
+    }
+    add("pipelined", batch, PIPELINE);
+}
+
+// load()
+// puts hdr in R's header buffer as if it
+// had just come off the socket.
+static void load(Request R, const char *hdr) {
+    size_t len = strlen(hdr);
+    memcpy(getHeadBuf(R), hdr, len);
+    setHeadLen(R, len);
+    stringify_hd(R, len);
+}
+
+// now_ns()
+static double now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// parse_all()
+// loads c into R and parses each of its
+// requests with parser, moving on to the next
+// the way a keep-alive connection does. if
+// stats isn't NULL it gets each one's status.
+// R is replaced if a failed parse closes it.
+static void parse_all(Request *pR, void (*parser)(Request), const Case *c, int *stats) {
+    load(*pR, c->text);
+    for (int i = 0; i < c->reqs; i++) {
+        parser(*pR);
+        if (stats != NULL) {
+            stats[i] = getStatus(*pR);
+        }
+        if (!reset_request(*pR)) {
+            freeRequest(pR);
+            *pR = newRequest();
+            break;
+        }
+    }
+}
+
+// Result is what run() measured
+typedef struct Result {
+    double ns; // per request
+    double allocs; // per request
+} Result;
+
+// run()
+// parses c with parser over and over for
+// budget_ms. the two parsers differ by three
+// orders of magnitude, so a time budget rather
+// than a fixed count keeps both runs
+// meaningful.
+static Result run(Request *pR, void (*parser)(Request), const Case *c, int budget_ms) {
+    long parses = 0;
+    parse_all(pR, parser, c, NULL); // warm R's pool and the caches
+    unsigned long a0 = allocs;
+    double t0 = now_ns(), t1;
+    do {
+        for (int i = 0; i < BATCH; i++) {
+            parse_all(pR, parser, c, NULL);
+        }
+        parses += BATCH * c->reqs;
+        t1 = now_ns();
+    } while (t1 - t0 < budget_ms * 1e6);
+    return (Result) { (t1 - t0) / parses, (double) (allocs - a0) / parses };
+}
+
+// statuses()
+// one pass over c, for the equivalence check.
+static void statuses(void (*parser)(Request), const Case *c, int *stats) {
+    Request R = newRequest();
+    memset(stats, -1, c->reqs * sizeof(int)); // requests after a close aren't parsed
+    parse_all(&R, parser, c, stats);
+    freeRequest(&R);
+}
+
+// dump()
+// writes each case to its own file in dir, as
+// seeds for bench/parsefuzz.
+static int dump(const char *dir) {
+    mkdir(dir, 0755);
+    for (int c = 0; c < ncases; c++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, cases[c].name);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, cases[c].text, strlen(cases[c].text)) < 0) {
+            warn("%s", path);
+            return EXIT_FAILURE;
+        }
+        close(fd);
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    build_corpus();
+    int opt;
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        if (opt == 'd') {
+            return dump(optarg);
+        }
+        warnx("Usage:\n./parsebench [-d seed_dir] [ms per run]");
+        exit(EXIT_FAILURE);
+    }
+    int budget = optind < argc ? atoi(argv[optind]) : BUDGET_MS;
+    if (budget < 1) {
+        warnx("Usage:\n./parsebench [-d seed_dir] [ms per run]");
+        exit(EXIT_FAILURE);
+    }
+    Request R = newRequest();
+    int mismatches = 0;
+
+    // the regex parser complains about every bad request
+    // line on stderr, so mismatches get a stream of their own
+    FILE *log = fdopen(dup(STDERR_FILENO), "w");
+    if (log == NULL || freopen("/dev/null", "w", stderr) == NULL) {
+        log = stderr;
+    }
+
+    // every header scanner this cpu can run, default last
+    const char *dflt = scan_impl();
+    const char *impls[3];
+    int nimpls = 0;
+    const char *all[] = { "scalar", "sse2", "avx2" };
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(all[i], dflt) != 0 && scan_select(all[i])) {
+            impls[nimpls++] = all[i];
+        }
+    }
+    impls[nimpls++] = dflt;
+    double tot_rx = 0, tot[3] = { 0 }; // ns per request, summed over the corpus
+
+    printf("%-10s %5s %6s %9s %6s", "case", "bytes", "status", "regex ns", "allocs");
+    for (int i = 0; i < nimpls; i++) {
+        printf(" %6s ns %6s", impls[i], "allocs");
+    }
+    printf(" %8s\n", "speedup");
+    for (int c = 0; c < ncases; c++) {
+        const Case *cs = &cases[c];
+        int s_rx[PIPELINE], s_fast[PIPELINE];
+        statuses(parse_request_regex, cs, s_rx);
+        Result rx = run(&R, parse_request_regex, cs, budget);
+        tot_rx += rx.ns;
+        printf("%-10s %5zu %6d %9.0f %6.1f", cs->name, strlen(cs->text), s_rx[0], rx.ns,
+            rx.allocs);
+        Result fast = { 0, 0 };
+        for (int i = 0; i < nimpls; i++) {
+            scan_select(impls[i]);
+            statuses(parse_request, cs, s_fast);
+            for (int k = 0; k < cs->reqs; k++) {
+                if (s_rx[k] != s_fast[k]) {
+                    fprintf(log, "parsebench: %s, request %d: regex says %d, %s says %d\n",
+                        cs->name, k, s_rx[k], impls[i], s_fast[k]);
+                    mismatches++;
+                }
+            }
+            fast = run(&R, parse_request, cs, budget);
+            tot[i] += fast.ns;
+            printf(" %9.0f %6.1f", fast.ns, fast.allocs);
+        }
+        printf(" %7.0fx\n", rx.ns / fast.ns); // default scanner vs regex
+    }
+    printf("%-10s %5s %6s %9.0f %6s", "mean", "", "", tot_rx / ncases, "");
+    for (int i = 0; i < nimpls; i++) {
+        printf(" %9.0f %6s", tot[i] / ncases, "");
+    }
+    printf(" %7.0fx\n", tot_rx / tot[nimpls - 1]);
+
+    freeRequest(&R);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
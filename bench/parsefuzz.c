@@ -0,0 +1,105 @@
+/*
+
+joey vigil
+jovigil
+cse130
+parsefuzz.c
+~libFuzzer entry point checking
+parse_request() against the regex
+parser~
+
+*/
+
+#include "../parse.h"
+#include "../scan.h"
+#include <stdint.h>
+
+// status_of()
+// parses the size bytes at data as one
+// header buffer with parser and returns the
+// resulting status, 0 for accepted.
+static int status_of(void (*parser)(Request), const uint8_t *data, size_t size) {
+    Request R = newRequest();
+    memcpy(getHeadBuf(R), data, size);
+    setHeadLen(R, size);
+    stringify_hd(R, size);
+    parser(R);
+    int stat = getStatus(R);
+    freeRequest(&R);
+    return stat;
+}
+
+// check()
+// true if parse_request(), with every header
+// scanner this cpu can run, accepts or rejects
+// data with the same status as the regex
+// parser. anything past BUF_SIZE bytes could
+// never reach a parser, so it is cut off.
+static bool check(const uint8_t *data, size_t size) {
+    static const char *dflt = NULL;
+    if (dflt == NULL) {
+        dflt = scan_impl();
+    }
+    if (size > BUF_SIZE) {
+        size = BUF_SIZE;
+    }
+    int want = status_of(parse_request_regex, data, size);
+    bool same = true;
+    const char *impls[] = { "scalar", "sse2", "avx2" };
+    for (int i = 0; i < 3; i++) {
+        if (!scan_select(impls[i])) {
+            continue;
+        }
+        int got = status_of(parse_request, data, size);
+        if (got != want) {
+            fprintf(stdout, "parsefuzz: regex says %d, %s says %d\n", want, impls[i], got);
+            same = false;
+        }
+    }
+    scan_select(dflt);
+    return same;
+}
+
+// LLVMFuzzerTestOneInput()
+// libFuzzer's hook. a mismatch is a crash,
+// so the fuzzer saves the input. run it with
+// -close_fd_mask=2 to hide the regex
+// parser's warnings.
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (!check(data, size)) {
+        abort();
+    }
+    return 0;
+}
+
+#ifdef REPLAY
+// main()
+// without libFuzzer: runs the check on each
+// file named, e.g. a saved crash or a seed
+// corpus from parsebench -d, and exits 1 if
+// any of them mismatch.
+int main(int argc, char *argv[]) {
+    static uint8_t buf[BUF_SIZE];
+    int bad = 0;
+    // the regex parser warns on stderr for every header it rejects
+    if (freopen("/dev/null", "w", stderr) == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            printf("parsefuzz: can't open %s\n", argv[i]);
+            bad++;
+            continue;
+        }
+        size_t n = fread(buf, 1, sizeof(buf), f);
+        fclose(f);
+        if (!check(buf, n)) {
+            printf("parsefuzz: ^ %s\n", argv[i]);
+            bad++;
+        }
+    }
+    printf("%d of %d inputs agree\n", argc - 1 - bad, argc - 1);
+    return bad == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
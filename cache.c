@@ -0,0 +1,387 @@
+/*
+
+joey vigil
+jovigil
+cse130
+cache.c
+~source file for the in-memory
+hot file cache~
+
+*/
+
+#include "cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define BUCKETS        1024 // hash chains, a power of two
+#define ADMIT_FRACTION 8 // largest object is budget / this
+#define KEY_MAX        64 // uris are at most 63 chars
+
+// private types
+
+/*
+a CacheEntryObj holds one complete, immutable response: the
+precomputed header followed by the file's bytes. entries are
+reference counted. the table holds one reference while an
+entry is findable, and each reader holds one while it sends;
+whoever drops the last one frees it. so invalidation and
+eviction only ever unlink an entry, and a reader in the middle
+of a send keeps a whole (if old) copy.
+
+an entry holds either the response bytes (data) or, for files
+too big for memory, the file kept open (fd), which saves a hot
+GET the open and fstat. each kind sits on its own circular list
+swept by its own CLOCK hand, so open files never push bytes out
+or the other way around. a hit sets the entry's ref bit; when a
+limit is exceeded the hand clears set bits and evicts the first
+entry it finds clear.
+
+each bucket has a generation counter bumped by every
+invalidation that lands in it. a filler snapshots it before
+reading the file and only inserts if it has not moved.
+*/
+
+typedef struct CacheEntryObj {
+    char key[KEY_MAX];
+    char *data; // header then body, NULL if fd is held instead
+    size_t len; // bytes in data
+    int hdr_len; // bytes of header at the front of data
+    int fd; // the open file, -1 if data is held instead
+    struct stat st; // fstat() of the file when it was cached
+    atomic_int refs;
+    bool ref_bit; // touched since the hand last passed
+    struct CacheEntryObj *chain; // next in bucket
+    struct CacheEntryObj *prev, *next; // clock ring
+} CacheEntryObj;
+
+enum entryKinds { DATA, FILE_FD, KINDS };
+
+static struct {
+    bool on;
+    size_t limit[KINDS]; // bytes of data, open files allowed
+    size_t used[KINDS]; // bytes of data, open files held
+    size_t max_obj; // largest body admitted to memory
+    CacheEntry table[BUCKETS];
+    unsigned long gen[BUCKETS];
+    CacheEntry hand[KINDS]; // clock hands, NULL when empty
+    pthread_mutex_t lock;
+} C = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// private functions
+
+// bucket()
+// FNV-1a of key, folded to a bucket index.
+static unsigned bucket(const char *key) {
+    uint32_t h = 2166136261u;
+    for (; *key != '\0'; key++) {
+        h = (h ^ (unsigned char) *key) * 16777619u;
+    }
+    return h & (BUCKETS - 1);
+}
+
+// new_data()
+// a data entry with room for hdr and a size
+// byte body, hdr already copied in.
+static CacheEntry new_data(const struct stat *st, const char *hdr, int hdr_len, size_t size) {
+    CacheEntry e = malloc(sizeof(CacheEntryObj));
+    if (e == NULL) {
+        return NULL;
+    }
+    e->len = hdr_len + size;
+    e->data = malloc(e->len + 1); // never NULL for an empty entry
+    e->fd = -1;
+    e->st = *st;
+    e->hdr_len = hdr_len;
+    if (e->data == NULL) {
+        free(e);
+        return NULL;
+    }
+    memcpy(e->data, hdr, hdr_len);
+    return e;
+}
+
+// kind()
+// which list e is on.
+static int kind(CacheEntry e) {
+    return e->data != NULL ? DATA : FILE_FD;
+}
+
+// cost()
+// what e counts against its kind's limit. the
+// struct counts too, so even empty entries
+// are bounded.
+static size_t cost(CacheEntry e) {
+    return e->data != NULL ? e->len + sizeof(CacheEntryObj) : 1;
+}
+
+// free_entry()
+// frees e and whatever it holds.
+static void free_entry(CacheEntry e) {
+    if (e->fd >= 0) {
+        close(e->fd);
+    }
+    free(e->data);
+    free(e);
+}
+
+// drop_ref()
+// frees e once its last reference is gone.
+static void drop_ref(CacheEntry e) {
+    if (atomic_fetch_sub(&e->refs, 1) == 1) {
+        free_entry(e);
+    }
+}
+
+// unlink_entry()
+// takes e out of its chain and the ring and
+// drops the table's reference. lock held.
+static void unlink_entry(CacheEntry e, unsigned b) {
+    CacheEntry *pp = &C.table[b];
+    while (*pp != e) {
+        pp = &(*pp)->chain;
+    }
+    *pp = e->chain;
+    int k = kind(e);
+    if (e->next == e) {
+        C.hand[k] = NULL;
+    } else {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+        if (C.hand[k] == e) {
+            C.hand[k] = e->next;
+        }
+    }
+    C.used[k] -= cost(e);
+    drop_ref(e);
+}
+
+// find()
+// key's entry in bucket b, or NULL. lock held.
+static CacheEntry find(const char *key, unsigned b) {
+    CacheEntry e = C.table[b];
+    while (e != NULL && strcmp(e->key, key) != 0) {
+        e = e->chain;
+    }
+    return e;
+}
+
+// insert()
+// makes e findable under key, replacing any
+// entry another filler beat us to and running
+// the clock hand of e's kind until e fits.
+// fails, leaving e to the caller, if key was
+// invalidated since gen was taken.
+static bool insert(CacheEntry e, const char *key, unsigned long gen) {
+    strcpy(e->key, key);
+    e->ref_bit = false;
+    atomic_init(&e->refs, 2); // the table's and the caller's
+
+    unsigned b = bucket(key);
+    int k = kind(e);
+    pthread_mutex_lock(&C.lock);
+    if (C.gen[b] != gen) { // a PUT got in, what we saw may be stale
+        pthread_mutex_unlock(&C.lock);
+        return false;
+    }
+    CacheEntry old = find(key, b);
+    if (old != NULL) {
+        unlink_entry(old, b);
+    }
+    while (C.hand[k] != NULL && C.used[k] + cost(e) > C.limit[k]) {
+        CacheEntry v = C.hand[k];
+        if (v->ref_bit) {
+            v->ref_bit = false;
+            C.hand[k] = v->next;
+        } else {
+            unlink_entry(v, bucket(v->key));
+        }
+    }
+    e->chain = C.table[b];
+    C.table[b] = e;
+    if (C.hand[k] == NULL) {
+        e->prev = e->next = e;
+        C.hand[k] = e;
+    } else { // just behind the hand, so it gets a full lap
+        e->next = C.hand[k];
+        e->prev = C.hand[k]->prev;
+        C.hand[k]->prev->next = e;
+        C.hand[k]->prev = e;
+    }
+    C.used[k] += cost(e);
+    pthread_mutex_unlock(&C.lock);
+    return true;
+}
+
+// public function defs
+
+// cache_init()
+// turns the cache on with room for budget
+// bytes of responses and files open files.
+bool cache_init(size_t budget, int files) {
+    if (budget == 0 && files <= 0) {
+        return false;
+    }
+    C.limit[DATA] = budget;
+    C.limit[FILE_FD] = files > 0 ? files : 0;
+    C.max_obj = budget / ADMIT_FRACTION;
+    C.on = true;
+    return true;
+}
+
+// cache_enabled()
+bool cache_enabled(void) {
+    return C.on;
+}
+
+// cache_room()
+size_t cache_room(void) {
+    return (C.on && C.limit[DATA] > 0) ? C.max_obj : 0;
+}
+
+// cache_get()
+// looks up key and returns its entry with a
+// reference held, or NULL on a miss.
+CacheEntry cache_get(const char *key) {
+    if (!C.on) {
+        return NULL;
+    }
+    unsigned b = bucket(key);
+    pthread_mutex_lock(&C.lock);
+    CacheEntry e = find(key, b);
+    if (e != NULL) {
+        atomic_fetch_add(&e->refs, 1);
+        e->ref_bit = true;
+    }
+    pthread_mutex_unlock(&C.lock);
+    return e;
+}
+
+// cache_gen()
+// snapshot to take before reading the file
+// behind key.
+unsigned long cache_gen(const char *key) {
+    unsigned b = bucket(key);
+    pthread_mutex_lock(&C.lock);
+    unsigned long g = C.gen[b];
+    pthread_mutex_unlock(&C.lock);
+    return g;
+}
+
+// cache_fill()
+// reads fd into a new entry for key and
+// inserts it, if it is admissible and key has
+// not been invalidated since gen.
+CacheEntry cache_fill(const char *key, int fd, const struct stat *st, unsigned long gen,
+    const char *hdr, int hdr_len) {
+    off_t size = st->st_size;
+    if (!C.on || C.limit[DATA] == 0 || (size_t) size > C.max_obj || strlen(key) >= KEY_MAX) {
+        return NULL;
+    }
+
+    // read outside the lock; the gen check in insert() catches races
+    CacheEntry e = new_data(st, hdr, hdr_len, size);
+    if (e == NULL) {
+        return NULL;
+    }
+    off_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, e->data + hdr_len + got, size - got, got);
+        if (n <= 0) {
+            free_entry(e);
+            return NULL;
+        }
+        got += n;
+    }
+    if (!insert(e, key, gen)) {
+        free_entry(e);
+        return NULL;
+    }
+    return e;
+}
+
+// cache_put()
+// like cache_fill(), with the body given.
+CacheEntry cache_put(const char *key, const struct stat *st, unsigned long gen, const char *hdr,
+    int hdr_len, const char *body, size_t body_len) {
+    if (!C.on || C.limit[DATA] == 0 || body_len > C.max_obj || strlen(key) >= KEY_MAX) {
+        return NULL;
+    }
+    CacheEntry e = new_data(st, hdr, hdr_len, body_len);
+    if (e == NULL) {
+        return NULL;
+    }
+    memcpy(e->data + hdr_len, body, body_len);
+    if (!insert(e, key, gen)) {
+        free_entry(e);
+        return NULL;
+    }
+    return e;
+}
+
+// cache_hold()
+// like cache_fill(), but the new entry keeps
+// fd itself open instead of its bytes.
+CacheEntry cache_hold(const char *key, int fd, const struct stat *st, unsigned long gen) {
+    if (!C.on || C.limit[FILE_FD] == 0 || strlen(key) >= KEY_MAX) {
+        return NULL;
+    }
+    CacheEntry e = malloc(sizeof(CacheEntryObj));
+    if (e == NULL) {
+        return NULL;
+    }
+    e->data = NULL;
+    e->len = 0;
+    e->hdr_len = 0;
+    e->fd = fd;
+    e->st = *st;
+    if (!insert(e, key, gen)) {
+        free(e); // fd stays with the caller
+        return NULL;
+    }
+    return e;
+}
+
+// cache_data()
+// the bytes of e's response, header then body,
+// or NULL if e holds an open file.
+const char *cache_data(CacheEntry e, size_t *len, int *hdr_len) {
+    *len = e->len;
+    *hdr_len = e->hdr_len;
+    return e->data;
+}
+
+// cache_file()
+// e's open file, or -1 if e holds the bytes.
+int cache_file(CacheEntry e, struct stat *st) {
+    *st = e->st;
+    return e->fd;
+}
+
+// cache_release()
+// drops a reference from cache_get() or
+// cache_fill().
+void cache_release(CacheEntry e) {
+    if (e != NULL) {
+        drop_ref(e);
+    }
+}
+
+// cache_invalidate()
+// drops key's entry, if any.
+void cache_invalidate(const char *key) {
+    if (!C.on) {
+        return;
+    }
+    unsigned b = bucket(key);
+    pthread_mutex_lock(&C.lock);
+    C.gen[b]++;
+    CacheEntry e = find(key, b);
+    if (e != NULL) {
+        unlink_entry(e, b);
+    }
+    pthread_mutex_unlock(&C.lock);
+}
@@ -0,0 +1,113 @@
+/*
+
+joey vigil
+jovigil
+cse130
+cache.h
+~header file for the in-memory
+hot file cache~
+
+*/
+
+#ifndef CACHE_H_INCLUDE_
+#define CACHE_H_INCLUDE_
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// exported types
+
+typedef struct CacheEntryObj *CacheEntry;
+
+// exported functs
+
+// cache_init()
+// turns the cache on with room for budget
+// bytes of responses and files open files.
+// objects bigger than budget / ADMIT_FRACTION
+// are never held in memory, but may be held
+// open instead. either limit may be 0. call
+// once, before any other cache_ funct.
+// returns false if both are 0.
+bool cache_init(size_t budget, int files);
+
+// cache_enabled()
+// true once cache_init() has succeeded.
+bool cache_enabled(void);
+
+// cache_room()
+// the biggest body cache_fill() or cache_put()
+// will take, 0 if entries can't hold bytes.
+size_t cache_room(void);
+
+// cache_get()
+// looks up key and returns its entry with a
+// reference held, or NULL on a miss. the
+// entry stays valid, and never changes,
+// until it is handed to cache_release().
+// an entry holds either the whole response
+// (see cache_data()) or an open fd on the
+// file (see cache_file()).
+CacheEntry cache_get(const char *key);
+
+// cache_gen()
+// snapshot to take before reading the file
+// behind key, to be passed to cache_fill().
+unsigned long cache_gen(const char *key);
+
+// cache_fill()
+// reads the st->st_size bytes of fd into a new
+// entry for key, behind the hdr_len byte
+// response header hdr, and returns it with a
+// reference held. returns NULL, caching
+// nothing, if the object is too big, the read
+// comes up short, or key was invalidated since
+// gen was taken (so a GET racing a PUT can
+// never cache stale or half-written bytes).
+CacheEntry cache_fill(const char *key, int fd, const struct stat *st, unsigned long gen,
+    const char *hdr, int hdr_len);
+
+// cache_put()
+// like cache_fill(), but the body is the
+// body_len bytes at body rather than a file's,
+// e.g. a compressed copy of it. st is kept as
+// given. an empty entry (hdr_len and body_len
+// both 0) is allowed, to remember a miss.
+CacheEntry cache_put(const char *key, const struct stat *st, unsigned long gen, const char *hdr,
+    int hdr_len, const char *body, size_t body_len);
+
+// cache_hold()
+// like cache_fill(), but the new entry keeps
+// fd itself open instead of its bytes. on
+// success the entry owns fd; on NULL the
+// caller still does.
+CacheEntry cache_hold(const char *key, int fd, const struct stat *st, unsigned long gen);
+
+// cache_data()
+// the bytes of e's response, header then body,
+// or NULL if e holds an open file. *len gets
+// the total length and *hdr_len the length of
+// the header.
+const char *cache_data(CacheEntry e, size_t *len, int *hdr_len);
+
+// cache_file()
+// e's open file, or -1 if e holds the bytes.
+// the fd is shared: only read it at explicit
+// offsets (pread, sendfile with an offset),
+// never close it. *st gets the fstat() it
+// was cached with.
+int cache_file(CacheEntry e, struct stat *st);
+
+// cache_release()
+// drops a reference from cache_get() or
+// cache_fill().
+void cache_release(CacheEntry e);
+
+// cache_invalidate()
+// drops key's entry, if any, so that no later
+// cache_get() can return it. readers holding
+// it keep their (complete, old) copy.
+void cache_invalidate(const char *key);
+
+#endif
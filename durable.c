@@ -0,0 +1,151 @@
+/*
+
+joey vigil
+jovigil
+cse130
+durable.c
+~source file for PUT
+durability~
+
+*/
+
+#define _GNU_SOURCE // sync_file_range()
+#include "durable.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// private types
+
+/*
+a PUT lands in a temp file that is renamed over its target, so a
+crash can only ever leave the old file or the new one, as long as
+the new one's bytes are on disk before its name is. so a durable
+PUT flushes twice: its file before the rename, and the directory
+after it, before the reply says it is there.
+
+flushing each PUT on its own costs a trip to the disk per flush,
+however many PUTs are waiting. in group mode they take turns
+leading instead: whoever finds no flush running takes every PUT
+waiting so far, itself included, starts writeback on all of their
+files at once, then waits on each with fdatasync(), so the disk
+sees them together rather than one after another. the renames
+share one fsync() of the directory between them. the rest wait
+for it, and any that arrived after it started go in the next one,
+since it might have begun before their writes did. the busier it
+gets, the more PUTs each flush answers for. nothing but their own
+files is flushed, however much else is dirty.
+*/
+
+// a PUT waiting on a group flush, on its
+// own stack
+typedef struct Waiter {
+    struct Waiter *next;
+    int fd; // its temp file, or -1 if it waits on the directory
+    bool done; // a flush that started after it joined has finished
+    int err; // and the errno it failed with, 0 if it didn't
+} Waiter;
+
+static int mode = DUR_NONE;
+static int dir_fd = -1; // the served directory, open for reading so it can be flushed
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flushed = PTHREAD_COND_INITIALIZER;
+static Waiter *waiting = NULL; // joined since the last flush started
+static bool flushing = false;
+
+// private functions
+
+// flush_batch()
+// flushes every file in batch, and the
+// directory once if any of them waits on
+// it, giving each the errno of its own.
+static void flush_batch(Waiter *batch) {
+    bool dir = false;
+    for (Waiter *w = batch; w != NULL; w = w->next) {
+        if (w->fd < 0) {
+            dir = true;
+        } else { // only a head start, fdatasync() below is what answers
+            sync_file_range(w->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        }
+    }
+    int dir_err = 0;
+    if (dir) {
+        dir_err = fsync(dir_fd) == 0 ? 0 : errno;
+    }
+    for (Waiter *w = batch; w != NULL; w = w->next) {
+        if (w->fd < 0) {
+            w->err = dir_err;
+        } else {
+            w->err = fdatasync(w->fd) == 0 ? 0 : errno;
+        }
+    }
+}
+
+// group_flush()
+// waits for a flush of fd, or of the served
+// directory if fd is -1, that started after
+// this call did, leading it if none is
+// running.
+static int group_flush(int fd) {
+    Waiter me = { NULL, fd, false, 0 };
+    pthread_mutex_lock(&lock);
+    me.next = waiting;
+    waiting = &me;
+    while (!me.done) {
+        if (flushing) {
+            pthread_cond_wait(&flushed, &lock);
+            continue;
+        }
+        flushing = true;
+        Waiter *batch = waiting;
+        waiting = NULL;
+        pthread_mutex_unlock(&lock);
+        flush_batch(batch);
+        pthread_mutex_lock(&lock);
+        while (batch != NULL) { // each is free to go once done is set
+            Waiter *next = batch->next;
+            batch->done = true;
+            batch = next;
+        }
+        flushing = false;
+        pthread_cond_broadcast(&flushed);
+    }
+    pthread_mutex_unlock(&lock);
+    errno = me.err;
+    return me.err == 0 ? 0 : -1;
+}
+
+// public function defs
+
+// durable_init()
+bool durable_init(int m) {
+    if (m != DUR_NONE) {
+        dir_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) {
+            return false;
+        }
+    }
+    mode = m;
+    return true;
+}
+
+// durable_data()
+// fdatasync() skips the timestamps, which
+// nobody needs back after a crash.
+int durable_data(int fd) {
+    switch (mode) {
+    case DUR_FSYNC: return fdatasync(fd);
+    case DUR_GROUP: return group_flush(fd);
+    default: return 0;
+    }
+}
+
+// durable_name()
+int durable_name(void) {
+    switch (mode) {
+    case DUR_FSYNC: return fsync(dir_fd);
+    case DUR_GROUP: return group_flush(-1);
+    default: return 0;
+    }
+}
@@ -0,0 +1,48 @@
+/*
+
+joey vigil
+jovigil
+cse130
+durable.h
+~header file for PUT
+durability~
+
+*/
+
+#ifndef DURABLE_H_INCLUDE_
+#define DURABLE_H_INCLUDE_
+#include <stdbool.h>
+
+// exported types
+
+// how sure a PUT's 200/201 is that the file
+// will survive a crash
+enum durability {
+    DUR_NONE, // in the page cache, the kernel writes it back when it likes
+    DUR_FSYNC, // the file, then its name, flushed by each PUT on its own
+    DUR_GROUP, // the same, flushed together for every PUT waiting
+};
+
+// exported functs
+
+// durable_init()
+// sets the policy for every PUT from here on,
+// flushing the served directory (the cwd).
+// returns false if it can't be opened. call
+// once, before serving; until then it is
+// DUR_NONE.
+bool durable_init(int mode);
+
+// durable_data()
+// makes the bytes written to fd, a temp file
+// in the served directory, durable. returns
+// 0, or -1 with errno set.
+int durable_data(int fd);
+
+// durable_name()
+// makes the names in the served directory
+// durable, once a temp file is renamed into
+// place. returns 0, or -1 with errno set.
+int durable_name(void);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+
+joey vigil
+jovigil
+cse130
+engine.c
+~source file for the epoll
+connection engine~
+
+*/
+
+#define _GNU_SOURCE // accept4
+#include "engine.h"
+#include "parse.h"
+#include "shard.h"
+#include "admit.h"
+#include "wheel.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAX_EVENTS 256 // events handled per epoll_wait
+
+// private types
+
+/*
+the ConnObj type pairs a Request with the readiness its state
+machine last asked for, so the loop only touches the epoll
+interest list when that actually changes. the listening socket
+is registered with a NULL data pointer so it can be told apart
+from connections. closed ConnObjs go on a free list private to
+their loop, like Requests do in parse.c.
+
+every connection also has a Timer on its loop's Wheel, due when
+request_deadline() last said it would be. a deadline that moved
+later is only looked at again when its Timer comes due, so moving
+bytes costs the wheel nothing, and one that moved sooner, as when
+a request finishes and the connection goes idle, is moved up
+after the step that did it. a loop with connections just wakes
+once a tick to see which of them have run out of time.
+*/
+
+typedef struct ConnObj {
+    Timer timer; // first, so a due Timer is its ConnObj
+    Request R;
+    int want; // STEP_READ or STEP_WRITE
+    struct ConnObj *next_free; // free list link while pooled
+} ConnObj;
+
+typedef struct LoopArgs {
+    int lfd; // non-blocking listening socket, shared unless sharded
+    int shard; // cpu index this loop is pinned to, -1 if not
+} LoopArgs;
+
+// this loop's idle ConnObjs
+static _Thread_local ConnObj *conn_pool = NULL;
+
+// and its connections' deadlines
+static _Thread_local Wheel *wheel = NULL;
+
+// private functions
+
+// close_conn()
+// drops c from epfd and releases everything
+// it holds.
+static void close_conn(int epfd, ConnObj *c) {
+    int cfd = getCFD(c->R);
+    wheel_del(wheel, &c->timer);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, cfd, NULL);
+    close(cfd);
+    freeRequest(&c->R);
+    c->next_free = conn_pool;
+    conn_pool = c;
+    admit_done();
+}
+
+// drive_conn()
+// steps c's Request and re-arms epfd for
+// whatever it is now waiting on.
+static void drive_conn(int epfd, ConnObj *c) {
+    int res = step_request(c->R);
+    if (res == STEP_DONE) {
+        close_conn(epfd, c);
+        return;
+    }
+    wheel_sooner(wheel, &c->timer, request_deadline(c->R)); // a request done, now idle
+    if (res != c->want) {
+        struct epoll_event ev;
+        ev.events = (res == STEP_READ) ? EPOLLIN : EPOLLOUT;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, getCFD(c->R), &ev);
+        c->want = res;
+    }
+}
+
+// accept_all()
+// accepts every pending connection on lfd
+// and registers it with epfd and the wheel.
+// other loops race for the same socket, so
+// EAGAIN just means somebody else got there
+// first.
+static void accept_all(int epfd, int lfd) {
+    while (1) {
+        int cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                warn("accept");
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (!admit_conn()) {
+            shed_connection(cfd);
+            continue;
+        }
+        ConnObj *c = conn_pool;
+        if (c != NULL) {
+            conn_pool = c->next_free;
+        } else if ((c = malloc(sizeof(ConnObj))) == NULL) {
+            warnx("Cannot allocate connection");
+            shed_connection(cfd);
+            admit_done();
+            continue;
+        }
+        c->R = newRequest();
+        c->want = STEP_READ;
+        setCFD(c->R, cfd);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) != 0) {
+            warn("epoll_ctl");
+            close(cfd);
+            freeRequest(&c->R);
+            c->next_free = conn_pool;
+            conn_pool = c;
+            admit_done();
+            continue;
+        }
+        wheel_add(wheel, &c->timer, request_deadline(c->R));
+    }
+}
+
+// reap()
+// closes every connection whose deadline has
+// passed by now, and puts the ones that came
+// due but have moved on since back on the
+// wheel for their next.
+static void reap(int epfd, uint64_t now) {
+    Timer *t = wheel_expire(wheel, now);
+    while (t != NULL) {
+        ConnObj *c = (ConnObj *) t;
+        t = t->next;
+        uint64_t due = request_deadline(c->R);
+        if (due <= now) {
+            close_conn(epfd, c);
+        } else {
+            wheel_add(wheel, &c->timer, due);
+        }
+    }
+}
+
+// event_loop()
+// body of each engine thread.
+static void *event_loop(void *arg) {
+    LoopArgs *a = (LoopArgs *) arg;
+    struct epoll_event events[MAX_EVENTS];
+    if (a->shard >= 0 && shard_pin(a->shard) != 0) {
+        warnx("Cannot pin event loop %d", a->shard);
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        err(EXIT_FAILURE, "epoll_create1");
+    }
+
+    // EPOLLEXCLUSIVE keeps one accept from waking every loop
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, a->lfd, &ev) != 0) {
+        err(EXIT_FAILURE, "epoll_ctl");
+    }
+
+    Wheel w;
+    uint64_t now = wheel_clock();
+    wheel_init(&w, now);
+    wheel = &w;
+
+    while (1) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, wheel_wait(&w, now));
+        if (n < 0 && errno != EINTR) {
+            err(EXIT_FAILURE, "epoll_wait");
+        }
+        now = wheel_clock();
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_all(epfd, a->lfd);
+            } else {
+                drive_conn(epfd, (ConnObj *) events[i].data.ptr);
+            }
+        }
+        reap(epfd, now);
+    }
+    return NULL;
+}
+
+// public function defs
+
+// run_engine()
+// serves every connection accepted on socks
+// with loops event loop threads.
+int run_engine(Listener_Socket *socks, int loops, bool sharded) {
+    LoopArgs *a = calloc(loops, sizeof(LoopArgs));
+    if (a == NULL) {
+        return -1;
+    }
+
+    // the helper library only offers a blocking accept, so
+    // the engine takes over the listening fds directly
+    for (int i = 0; i < loops; i++) {
+        a[i].lfd = socks[sharded ? i : 0].fd;
+        a[i].shard = sharded ? i : -1;
+        int flags = fcntl(a[i].lfd, F_GETFL, 0);
+        if (flags < 0 || fcntl(a[i].lfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            warn("fcntl");
+            return -1;
+        }
+    }
+
+    // this thread runs the last loop itself, once the
+    // others have inherited its unpinned cpu mask
+    for (int i = 0; i < loops - 1; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, event_loop, &a[i]) != 0) {
+            warnx("Cannot create event loop thread");
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    event_loop(&a[loops - 1]);
+    return -1;
+}
@@ -0,0 +1,32 @@
+/*
+
+joey vigil
+jovigil
+cse130
+engine.h
+~header file for the epoll
+connection engine~
+
+*/
+
+#ifndef ENGINE_H_INCLUDE_
+#define ENGINE_H_INCLUDE_
+#include "asgn2_helper_funcs.h"
+#include <stdbool.h>
+
+// exported functs
+
+// run_engine()
+// serves every connection accepted on socks
+// with loops event loop threads, each with
+// its own epoll instance. a connection is
+// owned by the loop that accepted it for
+// its whole life and never blocks a thread.
+// loops share socks[0] unless sharded, in
+// which case loop i has socks[i] to itself
+// and is pinned to a cpu of its own (see
+// shard.h). only returns (with -1) if setup
+// fails.
+int run_engine(Listener_Socket *socks, int loops, bool sharded);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+
+joey vigil
+jovigil
+cse130
+gzip.c
+~source file for gzip content
+encoding~
+
+*/
+
+#include "gzip.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#define LEVEL  6 // zlib's default, most of the ratio for a fraction of 9's time
+#define WBITS  (15 + 16) // biggest window, gzip wrapper
+#define MEMLVL 8
+
+// smallest file that gets a variant, 0 while gzip is off
+static size_t min_size = 0;
+
+// private functions
+
+// skip_ows()
+// past the spaces and tabs at p.
+static const char *skip_ows(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+// q_zero()
+// true if the parameters at p, up to the end
+// of their list element, hold a q of 0.
+static bool q_zero(const char *p, const char *end) {
+    while (p < end && *p != ',') {
+        if ((*p == 'q' || *p == 'Q') && p + 1 < end && p[1] == '=') {
+            p += 2;
+            while (p < end && (*p == '0' || *p == '.')) {
+                p++;
+            }
+            return p == end || *p == ',' || *p == ';' || *p == ' ' || *p == '\t';
+        }
+        p++;
+    }
+    return false;
+}
+
+// public function defs
+
+// gzip_init()
+void gzip_init(size_t min) {
+    min_size = min > 0 ? min : 1;
+}
+
+// gzip_worth()
+bool gzip_worth(size_t size) {
+    return min_size > 0 && size >= min_size;
+}
+
+// gzip_accepted()
+// walks the list once. an explicit gzip
+// decides; failing that, * does.
+bool gzip_accepted(const char *val, int len) {
+    const char *p = val, *end = val + len;
+    int star = -1; // -1 unseen, else whether * allows it
+    while (p < end) {
+        p = skip_ows(p, end);
+        const char *tok = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        int tok_len = p - tok;
+        bool zero = q_zero(p, end);
+        if ((tok_len == 4 && strncasecmp(tok, "gzip", 4) == 0)
+            || (tok_len == 6 && strncasecmp(tok, "x-gzip", 6) == 0)) {
+            return !zero;
+        }
+        if (tok_len == 1 && *tok == '*') {
+            star = !zero;
+        }
+        while (p < end && *p != ',') {
+            p++;
+        }
+        p++;
+    }
+    return star == 1;
+}
+
+// gzip_deflate()
+char *gzip_deflate(const char *in, size_t len, size_t *out_len) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, LEVEL, Z_DEFLATED, WBITS, MEMLVL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    size_t room = len - len / 8; // anything bigger isn't worth sending
+    char *out = malloc(room);
+    if (out == NULL) {
+        deflateEnd(&z);
+        return NULL;
+    }
+    z.next_in = (Bytef *) in;
+    z.avail_in = len; // GZIP_MAX keeps these in range
+    z.next_out = (Bytef *) out;
+    z.avail_out = room;
+    int ret = deflate(&z, Z_FINISH);
+    *out_len = z.total_out;
+    deflateEnd(&z);
+    if (ret != Z_STREAM_END) { // ran out of room, or broke
+        free(out);
+        return NULL;
+    }
+    return out;
+}
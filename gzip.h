@@ -0,0 +1,47 @@
+/*
+
+joey vigil
+jovigil
+cse130
+gzip.h
+~header file for gzip content
+encoding~
+
+*/
+
+#ifndef GZIP_H_INCLUDE_
+#define GZIP_H_INCLUDE_
+#include <stdbool.h>
+#include <stddef.h>
+#define GZIP_MAX (64 << 20) // biggest file compressed on the fly
+
+// exported functs
+
+// gzip_init()
+// turns gzip variants on for files of at
+// least min bytes. smaller ones always go
+// out as they are, since compressing them
+// costs more than it saves. call once,
+// before serving.
+void gzip_init(size_t min);
+
+// gzip_worth()
+// true if gzip is on and a size byte file
+// is big enough to have a gzip variant.
+bool gzip_worth(size_t size);
+
+// gzip_accepted()
+// true if the len byte Accept-Encoding value
+// at val lets gzip through, i.e. it names
+// gzip (or x-gzip, or *) without q=0.
+bool gzip_accepted(const char *val, int len);
+
+// gzip_deflate()
+// compresses the len bytes at in into a
+// gzip stream and returns it, malloc()ed,
+// with its length in *out_len. returns NULL
+// if compressing would not save at least an
+// eighth, or on failure.
+char *gzip_deflate(const char *in, size_t len, size_t *out_len);
+
+#endif
@@ -11,71 +11,402 @@ echo server
 
 #include "asgn2_helper_funcs.h"
 #include "parse.h"
+#include "queue.h"
+#include "engine.h"
+#include "cache.h"
+#include "uring.h"
+#include "shard.h"
+#include "gzip.h"
+#include "stats.h"
+#include "alog.h"
+#include "admit.h"
+#include "durable.h"
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <errno.h>
+#include <ctype.h>
 
-#define USAGE "Usage:\n./echoserver <port>"
+#define USAGE          "Usage:\n./httpserver [-t threads] [-e | -u] [-s [-i]] [-c cache_size] [-f files] [-z gzip_min] [-m metrics_port] [-l access_log] [-a max_conns] [-b max_bytes] [-q queue_ms] [-d none|fsync|group] <port>"
+#define QUEUE_SCALE    4 // queue slots per worker thread
+#define SHED_QUEUE     4096 // queue slots when -q polices waits, instead of a blocked acceptor
+#define KEEPALIVE_SECS 5 // idle time before a blocking worker drops a client
+#define IDLE_SLICE_MS  50 // how often an idle worker looks for someone waiting on it
 
-int main(int argc, char *argv[]) {
+// parse_size()
+// reads a byte count like 4096, 64K, 256M or
+// 1G. returns 0 if str isn't one.
+static size_t parse_size(const char *str) {
+    char *end;
+    unsigned long long n = strtoull(str, &end, 10);
+    if (end == str) {
+        return 0;
+    }
+    switch (toupper((unsigned char) *end)) {
+    case 'G': n <<= 10; // fall through
+    case 'M': n <<= 10; // fall through
+    case 'K': n <<= 10; end++; break;
+    }
+    return *end == '\0' ? (size_t) n : 0;
+}
+
+// idle_wait()
+// waits for cfd's next request, giving up
+// after KEEPALIVE_SECS, or as soon as another
+// connection is waiting in Q for this thread.
+// returns true if there is something to read.
+static bool idle_wait(int cfd, Queue Q) {
+    struct pollfd pfd = { .fd = cfd, .events = POLLIN };
+    for (int ms = 0; ms < KEEPALIVE_SECS * 1000; ms += IDLE_SLICE_MS) {
+        int n = poll(&pfd, 1, IDLE_SLICE_MS);
+        if (n > 0) {
+            return true;
+        }
+        if ((n < 0 && errno != EINTR) || queue_busy(Q)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// serve_connection()
+// serves requests from cfd until the client
+// closes, asks to close, goes idle, or sends
+// something unframeable, then closes it.
+// connections are only kept alive by workers
+// of Q, and only while nobody is waiting in
+// Q: served on the thread that accepts (Q is
+// NULL), an idle client would keep every
+// other one waiting.
+static void serve_connection(int cfd, Queue Q) {
+    Request Req = newRequest();
+    setCFD(Req, cfd);
 
-    // allocate Listener_Socket struct
-    Listener_Socket *sock = (Listener_Socket *) malloc(sizeof(Listener_Socket));
+    // an idle keep-alive client must not pin this thread forever,
+    // and a stalled reader must let it look at the body's deadline
+    struct timeval idle = { .tv_sec = KEEPALIVE_SECS, .tv_usec = 0 };
+    setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+    setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+
+    bool first = true;
+    do {
+        // between requests, give the thread up to anyone
+        // waiting for it rather than to an idle client
+        if (!first && getHeadLen(Req) == 0 && !idle_wait(cfd, Q)) {
+            break;
+        }
+        first = false;
+
+        // read from socket into the header buffer, on top
+        // of whatever the last request left behind
+        if (read_header(Req) <= 0) {
+            break;
+        }
+
+        // send header to parser
+        uint64_t t = stats_clock();
+        parse_request(Req);
+        stats_phase(PH_PARSE, t);
+        if (Q == NULL || queue_busy(Q)) {
+            dropKeepAlive(Req);
+        }
+
+        // send request to handler
+        handle_request(Req);
+    } while (reset_request(Req));
+
+    // close connection and free memory
+    close(cfd);
+    freeRequest(&Req);
+    admit_done();
+}
+
+// worker()
+// pulls accepted connections off the shared
+// queue and serves them, forever.
+static void *worker(void *arg) {
+    Queue Q = (Queue) arg;
+    while (1) {
+        uint64_t waited;
+        int cfd = dequeue(Q, &waited);
+        stats_took(PH_ACCEPT, waited);
+        if (admit_late(waited)) { // the client has likely given up on it anyway
+            shed_connection(cfd);
+            admit_done();
+            continue;
+        }
+        serve_connection(cfd, Q);
+    }
+    return NULL;
+}
+
+// Shard bundles one worker's listener with
+// the cpu it is pinned to.
+typedef struct Shard {
+    Listener_Socket *sock;
+    int i;
+} Shard;
+
+// shard_worker()
+// pins itself, then accepts on its own
+// listener and serves inline, forever.
+static void *shard_worker(void *arg) {
+    Shard *s = (Shard *) arg;
+    if (shard_pin(s->i) != 0) {
+        warnx("Cannot pin worker %d", s->i);
+    }
+    while (1) {
+        int cfd = listener_accept(s->sock);
+        if (cfd < 0) {
+            warnx("Could not accept on shard %d", s->i);
+            continue;
+        }
+        if (!admit_conn()) {
+            shed_connection(cfd);
+            continue;
+        }
+        serve_connection(cfd, NULL);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int threads = 0; // 0 means serve on the accepting thread
+    bool event = false; // use the epoll engine instead
+    bool ring = false; // or the io_uring one
+    bool sharded = false; // one listener per thread, each pinned
+    bool steer = false; // and hand connections to the cpu they arrived on
+    size_t cache_size = 0; // bytes of hot files kept in memory
+    int cache_files = 0; // hot files kept open
+    size_t gzip_min = 0; // smallest file worth sending gzipped, 0 for never
+    int metrics_port = 0; // where to serve counters and latencies, 0 for nowhere
+    const char *access_log = NULL; // file to log each request to, "-" for stdout
+    int max_conns = 0; // connections open at once before new ones get a 503, 0 for no limit
+    size_t max_bytes = 0; // body bytes in flight before new requests get a 503, 0 for no limit
+    int queue_ms = 0; // queue wait before connections get a 503 under overload, 0 for none
+    int durability = DUR_NONE; // what a PUT flushes before it is answered
+    int opt;
 
     // check for usage error and invalid port number
-    if (argc != 2) {
+    while ((opt = getopt(argc, argv, "t:eusic:f:z:m:l:a:b:q:d:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                warnx("Invalid thread count");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'e': event = true; break;
+        case 'u': ring = true; break;
+        case 's': sharded = true; break;
+        case 'i': steer = true; break;
+        case 'c':
+            cache_size = parse_size(optarg);
+            if (cache_size == 0) {
+                warnx("Invalid cache size");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            cache_files = atoi(optarg);
+            if (cache_files < 1) {
+                warnx("Invalid open file count");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'z':
+            gzip_min = parse_size(optarg);
+            if (gzip_min == 0) {
+                warnx("Invalid gzip size");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            metrics_port = atoi(optarg);
+            if (metrics_port < 1 || metrics_port > 65535) {
+                warnx("Invalid metrics port");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l': access_log = optarg; break;
+        case 'a':
+            max_conns = atoi(optarg);
+            if (max_conns < 1) {
+                warnx("Invalid connection limit");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            max_bytes = parse_size(optarg);
+            if (max_bytes == 0) {
+                warnx("Invalid byte limit");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            queue_ms = atoi(optarg);
+            if (queue_ms < 1) {
+                warnx("Invalid queue target");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "none") == 0) {
+                durability = DUR_NONE;
+            } else if (strcmp(optarg, "fsync") == 0) {
+                durability = DUR_FSYNC;
+            } else if (strcmp(optarg, "group") == 0) {
+                durability = DUR_GROUP;
+            } else {
+                warnx("Invalid durability");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            warnx(USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || (event && ring) || (steer && !sharded)) {
         warnx(USAGE);
         exit(EXIT_FAILURE);
     }
-    int p = atoi(argv[1]);
+    int p = atoi(argv[optind]);
     if (p < 1 || p > 65535) {
         warnx("Invalid port number");
         exit(EXIT_FAILURE);
     }
 
-    // initialize socket
-    int sock_init = listener_init(sock, p);
+    // allocate Listener_Socket structs, one per
+    // thread when sharded
+    int nsocks = sharded && threads > 0 ? threads : 1;
+    Listener_Socket *sock = (Listener_Socket *) malloc(nsocks * sizeof(Listener_Socket));
+
+    // initialize socket(s)
+    int sock_init = sharded ? shard_listeners(sock, nsocks, p, steer) : listener_init(sock, p);
     if (sock_init != 0) {
         warnx("Cannot initialize socket on port %d", p);
         exit(EXIT_FAILURE);
     }
 
-    // read/write loop
-    while (1) {
-        int read_bytes;
+    if ((cache_size > 0 || cache_files > 0) && !cache_init(cache_size, cache_files)) {
+        warnx("Cannot initialize cache");
+        exit(EXIT_FAILURE);
+    }
+    if (gzip_min > 0) {
+        gzip_init(gzip_min);
+    }
+    if (metrics_port > 0 && !stats_init(metrics_port)) {
+        warnx("Cannot serve metrics on port %d", metrics_port);
+        exit(EXIT_FAILURE);
+    }
 
-        // accept connection
-        int cfd = listener_accept(sock); // connection file descriptor
-        Request Req = newRequest();
-        setCFD(Req, cfd);
-        if (cfd == 0) {
-            warnx("Could not bind on port %d", p);
-            goto done;
-        }
+    if (access_log != NULL && !alog_init(access_log)) {
+        warnx("Cannot open access log %s", access_log);
+        exit(EXIT_FAILURE);
+    }
+
+    admit_init(max_conns, max_bytes, queue_ms);
+
+    if (!durable_init(durability)) {
+        warnx("Cannot open the served directory");
+        exit(EXIT_FAILURE);
+    }
 
-        // get pointer to header buffer of Request obect
-        char *hd_buf = getHeadBuf(Req);
+    // a client hanging up mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
 
-        // read from socket into buffer and write from buf to sock
-        read_bytes = read_until(cfd, hd_buf, BUF_SIZE, RNRN);
-        setHeadLen(Req, read_bytes);
-        if (read_bytes == -1) {
-            warnx("BAD READ");
-            goto done;
+    // an engine owns accepting and serving from here on,
+    // with -t picking how many loops (or rings) it runs
+    if (event) {
+        run_engine(sock, threads > 0 ? threads : 1, sharded);
+        exit(EXIT_FAILURE);
+    }
+    if (ring) {
+        run_uring(sock, threads > 0 ? threads : 1, sharded);
+        exit(EXIT_FAILURE);
+    }
+
+    // sharded workers accept for themselves, so there
+    // is no queue. this thread becomes the last of them
+    // once the others have copied its unpinned cpu mask.
+    if (sharded) {
+        Shard *shards = calloc(nsocks, sizeof(Shard));
+        for (int i = 0; i < nsocks; i++) {
+            shards[i] = (Shard) { &sock[i], i };
+        }
+        for (int i = 0; i < nsocks - 1; i++) {
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, shard_worker, &shards[i]) != 0) {
+                warnx("Cannot create worker thread");
+                exit(EXIT_FAILURE);
+            }
+            pthread_detach(tid);
         }
-        stringify_hd(Req, read_bytes); // put nul char at end of read material
+        shard_worker(&shards[nsocks - 1]);
+    }
 
-        // send header to parser
-        parse_request(Req);
+    // spin up the worker pool, if asked for one. this
+    // thread becomes the acceptor and only hands fds off.
+    // with a limit on, the acceptor never blocks on a full
+    // queue, which would only move the line into the kernel's
+    // backlog. the queue holds as many as the limits allow
+    // and anything past that is shed
+    Queue Q = NULL;
+    bool shedding = max_conns > 0 || queue_ms > 0;
+    if (threads > 0) {
+        int slots = threads * QUEUE_SCALE;
+        if (shedding) {
+            int limit = max_conns > 0 ? max_conns : SHED_QUEUE;
+            slots = limit > slots ? limit : slots;
+        }
+        Q = newQueue(slots);
+        if (Q == NULL) {
+            warnx("Cannot allocate connection queue");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < threads; i++) {
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, worker, Q) != 0) {
+                warnx("Cannot create worker thread");
+                exit(EXIT_FAILURE);
+            }
+            pthread_detach(tid);
+        }
+    }
 
-        // send request to handler
-        handle_request(Req);
+    // accept loop
+    while (1) {
 
-    done:
-        // close connection and free memory
-        close(cfd);
-        // printf("connection closed\n");
-        freeRequest(&Req);
+        // accept connection
+        int cfd = listener_accept(sock); // connection file descriptor
+        if (cfd < 0) {
+            warnx("Could not accept on port %d", p);
+            continue;
+        }
+
+        if (!admit_conn()) { // shed now, rather than after a wait in line
+            shed_connection(cfd);
+            continue;
+        }
+        if (Q != NULL) {
+            if (!shedding) {
+                enqueue(Q, cfd);
+            } else if (!try_enqueue(Q, cfd)) {
+                shed_connection(cfd);
+                admit_done();
+            }
+        } else {
+            serve_connection(cfd, NULL);
+        }
     }
+    freeQueue(&Q);
     free(sock);
     exit(EXIT_SUCCESS);
 }
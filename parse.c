@@ -9,8 +9,18 @@ server mssg parser~
 
 */
 
+#define _GNU_SOURCE // splice, pipe2, fallocate
 #include "parse.h"
 #include "asgn2_helper_funcs.h"
+#include "scan.h"
+#include "cache.h"
+#include "gzip.h"
+#include "stats.h"
+#include "alog.h"
+#include "admit.h"
+#include "wheel.h"
+#include "durable.h"
+#include "debug.h"
 #include <sys/stat.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -19,31 +29,117 @@ server mssg parser~
 #include <errno.h>
 #include <linux/limits.h>
 #include <regex.h>
-#include <dirent.h>
-#define NUL '\0'
+#include <strings.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#define NUL       '\0'
+#define PIPE_SIZE (1 << 20) // bytes a splice pipe holds
+#define PREALLOC_MIN (1 << 20) // smallest PUT body whose blocks are reserved up front
+#define POOL_MAX  64 // idle Requests kept per thread
+#define STRIPES   64 // per-uri PUT locks, a power of two
+#define TMP_SIZE  32 // "~put.<pid>.<n>"
+#define RANGE_MAX 16 // ranges served from one GET, more and it gets the whole file
+#define PART_SIZE 128 // boundary and Content-Range line of a multipart part
+#define ETAG_SIZE 72 // "ETag: "<ino>-<size>-<mtime>-gz"\r\n"
+#define GZKEY_SIZE 64 // "gz:<ino>-<size>-<mtime>", a cache key no uri can be
+#define DATE_SIZE 48 // "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+#define HTTP_DATE "%a, %d %b %Y %H:%M:%S GMT"
+#define HEADER_SECS 10 // to get a whole header in, however it trickles
+#define IDLE_SECS   5 // between requests on a kept-alive connection
+#define BODY_SECS   10 // grace before a body has to keep up MIN_RATE
+#define MIN_RATE    1024 // bytes a second a body averages past its grace
 
 // const strings for messages
 
 const char get[] = "GET";
 const char put[] = "PUT";
 const char http_vers[] = "HTTP/1.1";
-const char ok[] = "OK"; // these are for the status line
-const char created[] = "Created";
-const char bad_req[] = "Bad Request";
-const char forbidden[] = "Forbidden";
-const char not_found[] = "Not Found";
-const char serv_err[] = "Internal Server Error";
-const char not_impd[] = "Not Implemented";
-const char vrsn_nspd[] = "Version Not Supported";
-const char ok_msg[] = "OK\n";
-const char created_msg[] = "Created\n"; // and these are for the mssg body
-const char bad_req_msg[] = "Bad Request\n";
-const char forbidden_msg[] = "Forbidden\n";
-const char not_found_msg[] = "Not Found\n";
-const char serv_err_msg[] = "Internal Server Error\n";
-const char not_impd_msg[] = "Not Implemented\n";
-const char vrsn_nspd_msg[] = "Version Not Supported\n";
 const char content_length[] = "Content-Length:";
+const char connection[] = "Connection:";
+const char transfer_encoding[] = "Transfer-Encoding:";
+const char conn_close[] = "Connection: close\r\n";
+const char content_range[] = "Content-Range: bytes";
+const char multipart[] = "Content-Type: multipart/byteranges; boundary=";
+const char etag[] = "ETag:";
+const char last_modified[] = "Last-Modified:";
+const char content_encoding[] = "Content-Encoding: gzip\r\n";
+const char vary[] = "Vary: Accept-Encoding\r\n";
+
+// request headers kept for after the parse, when the target
+// is open, by where their values sit in hd_raw
+enum Kept { K_RANGE, K_ACCEPT_ENC, K_IF_RANGE, K_IF_NONE_MATCH, K_IF_MOD_SINCE, NKEPT };
+static const char *const kept[NKEPT] = { "Range", "Accept-Encoding", "If-Range", "If-None-Match",
+    "If-Modified-Since" };
+
+// canned responses
+
+/*
+every status we send has a Reply. line is its status line and
+rest is everything after it: any extra header the status always
+carries, a Content-Length header, the empty line and a body that
+is just the phrase. both are built once,
+before main(), so sending a response formats nothing but the
+Content-Length of a GET, whose rest is made per request. when the
+connection is closing, conn_close goes out between the two.
+*/
+
+typedef struct Reply {
+    int code;
+    const char *phrase;
+    const char *extra; // header lines before Content-Length, if any
+    char line[48]; // "HTTP/1.1 404 Not Found\r\n"
+    char rest[96]; // "Content-Length: 10\r\n\r\nNot Found\n"
+    int line_len;
+    int rest_len;
+} Reply;
+
+static Reply replies[] = {
+    { .code = OK, .phrase = "OK" },
+    { .code = CREATED, .phrase = "Created" },
+    { .code = PARTIAL, .phrase = "Partial Content" },
+    { .code = NOT_MOD, .phrase = "Not Modified" },
+    { .code = BAD_REQ, .phrase = "Bad Request" },
+    { .code = FORBIDDEN, .phrase = "Forbidden" },
+    { .code = NOT_FOUND, .phrase = "Not Found" },
+    { .code = RANGE_NSAT, .phrase = "Range Not Satisfiable" },
+    { .code = SERV_ERR, .phrase = "Internal Server Error" },
+    { .code = NOT_IMPD, .phrase = "Not Implemented" },
+    { .code = UNAVAIL, .phrase = "Service Unavailable", .extra = "Retry-After: 1\r\n" },
+    { .code = VRSN_NSPD, .phrase = "Version Not Supported" },
+    { .code = NO_SPACE, .phrase = "Insufficient Storage" },
+};
+
+#define NREPLIES (int) (sizeof(replies) / sizeof(replies[0]))
+
+// build_replies()
+// fills in every Reply's line and rest. runs
+// before main().
+__attribute__((constructor)) static void build_replies(void) {
+    for (int i = 0; i < NREPLIES; i++) {
+        Reply *r = &replies[i];
+        r->line_len
+            = snprintf(r->line, sizeof(r->line), "%s %d %s\r\n", http_vers, r->code, r->phrase);
+        r->rest_len = snprintf(r->rest, sizeof(r->rest), "%s%s %zu%s%s\n",
+            r->extra ? r->extra : "", content_length, strlen(r->phrase) + 1, RNRN, r->phrase);
+    }
+}
+
+// reply()
+// the Reply for status code stat.
+static const Reply *reply(int stat) {
+    for (int i = 0; i < NREPLIES; i++) {
+        if (replies[i].code == stat) {
+            return &replies[i];
+        }
+    }
+    warnx("INVALID STATUS CODE");
+    return reply(SERV_ERR);
+}
 
 // regexes
 const char rl[] = "([a-zA-Z]{1,8}) (/[a-zA-Z0-9.-]{1,63}) (HTTP/[0-9]\\.[0-9])\r\n";
@@ -69,66 +165,323 @@ the command, con_len, hd_eo,  fields with parsed info from the
 header, which was passed to it via hd_raw. the status code will be
 filled EITHER when parse_request() encounters in an error OR ELSE
 when handle_request() executes.
+
+RequestObjs are recycled rather than freed. hd_raw lives in the
+same allocation, right after the struct, and freeRequest() parks
+the whole thing on a free list private to the calling thread, so
+a worker that has warmed up serves connections without touching
+the heap. only the small bookkeeping fields are reset on reuse;
+fname and response are always written before they are read.
 */
 
+// first and last byte of one range of a file
+typedef struct Range {
+    off_t first;
+    off_t last;
+} Range;
+
 typedef struct RequestObj {
     char *hd_raw; // header raw buffer data
-    char response[HEAD_SIZE + 23]; // response char array
+    char response[HEAD_SIZE + 23]; // flat copy of the header, for the cache
+    char cl[448]; // header lines of a GET or 416, from the validators or Content-Range on
+    struct iovec out[3]; // status line, Connection: close, the rest
+    struct iovec ring_iov[3]; // what is left of out, for a ring's sendmsg
+    struct msghdr ring_msg; // and the sendmsg that points at it
+    bool ring_direct; // the ring ran out of buffers, recv into hd_raw
+    size_t pend; // body bytes a ring left in its scratch buffer, not yet written or sent
+    size_t pend_off; // and where in it they start
     char command[4]; // "GET," "PUT," or some other 3 letter word
     char fname[PATH_MAX]; // filename given by request
+    char tmp[TMP_SIZE]; // a PUT's temp file until it is renamed over fname
     int hd_read;
     int method; // integer indicator of command
-    int con_len; // content length of mssg body
-    int fcon_len; // content length of target file
+    off_t con_len; // content length of mssg body
+    off_t fcon_len; // content length of target file
     int hd_eo; // index of byte in hd_raw DIRECTLY AFTER header
     int status; // HTTP status code
     int tfd; // target file descriptor
     int cfd; // connection socket file desc
+    int state; // where step_request() picks back up
+    off_t resp_len; // bytes of out to send
+    off_t resp_off; // bytes of out already sent
+    off_t body_left; // PUT body bytes still to come off the socket
+    int coding; // the body's Transfer-Encoding
+    int ch_state; // where feed_chunks() picks back up
+    int ch_digits; // of the chunk size being read
+    off_t ch_left; // bytes of the chunk size, then of its data still to come
+    off_t woff; // file offset the next chunk byte goes to
+    off_t foff; // GET file offset of the next send
+    off_t fend; // GET file offset the range being sent stops at
+    int kept_at[NKEPT]; // offset of each kept header's value in hd_raw, 0 if none
+    int kept_len[NKEPT];
+    char etag[ETAG_SIZE]; // validators of a GET target, both lines
+    char modified[DATE_SIZE];
+    int stamp_len; // of the two, 0 if not made
+    bool gzip; // sending the target's gzip variant
+    bool vary; // the target has one, so what is sent depends on Accept-Encoding
+    Range ranges[RANGE_MAX]; // file bytes a GET sends, in order
+    int nranges;
+    int part; // which of ranges follows out
+    char boundary[24]; // between the parts of a multipart 206
+    char part_hdr[PART_SIZE]; // boundary and Content-Range of the part after the first
+    int buf_off; // bytes of hd_raw already sent while streaming
+    int buf_len; // bytes of hd_raw filled while streaming
+    HeaderScan scan; // CRLFs and end of the header in hd_raw
+    int next_off; // start of the next pipelined request in hd_raw
+    bool keep_alive; // false once the connection must close
+    CacheEntry hit; // cached response being sent, reference held
+    uint64_t t_start; // when the request's first byte came in, 0 if not timed
+    uint64_t t_ready; // when prepare_request() was done with it, 0 if not timed
+    off_t sent; // response bytes out so far
+    off_t held; // body bytes reserved with admit_bytes()
+    uint64_t waiting; // wheel_clock() when R began waiting on a header or its body
+    struct RequestObj *next_free; // free list link while pooled
 } RequestObj;
 
 enum methodCodes { NOT_SET, GET, PUT };
 
+enum codings { TE_NONE, TE_CHUNKED, TE_OTHER };
+
+// where a chunked body is, byte by byte
+enum chunkStates {
+    CH_SIZE, // hex digits of a chunk's size
+    CH_EXT, // extensions after the size, ignored
+    CH_SIZE_LF,
+    CH_DATA,
+    CH_DATA_CR,
+    CH_DATA_LF,
+    CH_TRAIL, // start of a trailer line, or the empty line
+    CH_TRAIL_SKIP, // inside a trailer field, ignored
+    CH_TRAIL_LF,
+    CH_DONE
+};
+
+enum stepStates {
+    ST_READ_HEAD,
+    ST_READ_BODY,
+    ST_COPY_BODY,
+    ST_READ_CHUNKS,
+    ST_COPY_CHUNKS,
+    ST_WRITE_HEAD,
+    ST_SEND_FILE,
+    ST_COPY_FILE,
+    ST_DONE
+};
+
 // private defs
 
-void get_ex(Request R);
-int put_ex(Request R);
+static ssize_t send_n_bytes(int fd, const char *buf, size_t n, int flags);
+static void open_temp(Request R);
+static void commit_put(Request R);
+
+bool get_ex(Request R);
+off_t put_ex(Request R);
+static int feed_chunks(Request R);
+static bool big_chunk(Request R);
+static bool put_chunked(Request R);
+static ssize_t splice_in(Request R, off_t n, off_t *off);
 
 // public function defs
 
-// newRequest()
-// allocates a Request and initializes its
-// fields. '\0' is placed at the ends of all
-// character buffers and ints are initialized
-// to zero.
-Request newRequest() {
-    Request R = malloc(sizeof(RequestObj));
-    R->hd_raw = (char *) malloc(BUF_SIZE + 1); // allocate buffers
-    R->hd_raw[BUF_SIZE] = NUL; // make sure no one can fall off!!
+// the directory served from, opened once so
+// each request's lookup is a single openat()
+static int root_fd = AT_FDCWD;
+
+// open_root()
+// runs before main(). if the directory can't
+// be held open, openat() falls back to
+// resolving against the cwd every time.
+__attribute__((constructor)) static void open_root(void) {
+    int fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        root_fd = fd;
+    }
+}
+
+// PUTs to the same uri commit one at a time
+// under that uri's stripe of this table
+static pthread_mutex_t put_locks[STRIPES];
+
+// init_put_locks()
+// runs before main().
+__attribute__((constructor)) static void init_put_locks(void) {
+    for (int i = 0; i < STRIPES; i++) {
+        pthread_mutex_init(&put_locks[i], NULL);
+    }
+}
+
+// put_lock()
+// the stripe of put_locks fn hashes to
+// (FNV-1a).
+static pthread_mutex_t *put_lock(const char *fn) {
+    uint32_t h = 2166136261u;
+    for (; *fn != NUL; fn++) {
+        h = (h ^ (unsigned char) *fn) * 16777619u;
+    }
+    return &put_locks[h & (STRIPES - 1)];
+}
+
+// close_target()
+// lets go of whatever R's last request was
+// serving from. while R holds a cache entry
+// tfd, if set, is the entry's and stays open.
+// a PUT that never got to commit leaves its
+// temp file behind, which goes too.
+static void close_target(Request R) {
+    if (R->tfd >= 0 && R->hit == NULL) {
+        close(R->tfd);
+    }
+    if (R->tmp[0] != NUL) {
+        unlinkat(root_fd, R->tmp, 0);
+        R->tmp[0] = NUL;
+    }
+    R->tfd = -1;
+    cache_release(R->hit);
+    R->hit = NULL;
+    admit_free(R->held);
+    R->held = 0;
+}
+
+// clear_request()
+// puts every per-request field of R back to
+// its initial value. hd_raw, hd_read and cfd
+// belong to the connection and are left alone.
+static void clear_request(Request R) {
     R->command[3] = NUL; // put nuls in strings
-    memset(R->fname, NUL, PATH_MAX);
-    memset(R->response, NUL, HEAD_SIZE + 23);
+    R->fname[0] = NUL;
     R->con_len = -1;
     R->hd_eo = 0;
     R->status = 0;
     R->tfd = -1;
-    R->cfd = 0;
+    R->tmp[0] = NUL;
     R->fcon_len = 0;
     R->method = NOT_SET;
+    R->state = ST_READ_HEAD;
+    R->resp_len = R->resp_off = 0;
+    R->body_left = 0;
+    R->coding = TE_NONE;
+    R->ch_state = CH_SIZE;
+    R->ch_digits = 0;
+    R->ch_left = R->woff = 0;
+    R->foff = R->buf_off = R->buf_len = 0;
+    R->fend = 0;
+    memset(R->kept_at, 0, sizeof(R->kept_at));
+    R->stamp_len = 0;
+    R->gzip = R->vary = false;
+    R->nranges = R->part = 0;
+    scan_reset(&R->scan);
+    R->next_off = 0;
+    R->keep_alive = true; // HTTP/1.1 default
+    R->ring_direct = false;
+    R->pend = R->pend_off = 0;
+    R->t_start = R->t_ready = 0;
+    R->sent = 0;
+    R->held = 0;
+}
+
+// this thread's idle Requests
+static _Thread_local Request pool = NULL;
+static _Thread_local int pooled = 0;
+
+// newRequest()
+// hands out a Request from this thread's pool,
+// or allocates one if the pool is empty, and
+// initializes its fields. '\0' is placed at
+// the start of all character buffers and ints
+// are initialized to zero.
+Request newRequest() {
+    Request R = pool;
+    if (R != NULL) {
+        pool = R->next_free;
+        pooled--;
+    } else {
+        R = malloc(sizeof(RequestObj) + BUF_SIZE + 1); // hd_raw rides along
+        R->hd_raw = (char *) (R + 1);
+        R->hd_raw[BUF_SIZE] = NUL; // make sure no one can fall off!!
+    }
+    R->hit = NULL;
+    R->cfd = 0;
     R->hd_read = 0;
+    R->waiting = wheel_clock();
+    stringify_hd(R, 0); // a recycled R still holds its old header
+    clear_request(R);
     return R;
 }
 
+// body_in()
+// bytes of R's PUT body taken in so far.
+static off_t body_in(Request R) {
+    if (R->method != PUT || R->tfd < 0) { // a refused body is never read
+        return 0;
+    }
+    return (R->coding == TE_CHUNKED) ? R->woff : R->con_len - R->body_left;
+}
+
+// end_request()
+// counts and logs R's request once it is
+// over, if it got as far as being handled:
+// its status, its bytes, and how long its
+// body and the whole of it took.
+static void end_request(Request R) {
+    if (R->t_ready == 0) {
+        return;
+    }
+    uint64_t end = stats_phase(PH_BODY, R->t_ready);
+    stats_phase(PH_TOTAL, R->t_start);
+    off_t body = body_in(R);
+    stats_request(R->status, R->hd_eo + body, R->sent);
+    alog_request(R->method == GET ? get : R->method == PUT ? put : "", R->fname, R->status,
+        R->hd_eo + body, R->sent, R->t_start, end);
+    R->t_ready = 0;
+}
+
+// reset_request()
+// readies R for the next request on the same
+// connection. bytes of hd_raw past the end of
+// the request just served are moved to the
+// front and become the start of the next
+// header. returns false, leaving R untouched,
+// if the connection has to be closed instead.
+bool reset_request(Request R) {
+    if (!R->keep_alive) {
+        return false;
+    }
+    end_request(R);
+    close_target(R);
+    R->waiting = wheel_clock();
+    int left = R->hd_read - R->next_off;
+    if (left > 0) {
+        memmove(R->hd_raw, R->hd_raw + R->next_off, left);
+    } else {
+        left = 0;
+    }
+    clear_request(R);
+    R->hd_read = left;
+    stringify_hd(R, left);
+    if (left > 0) { // the next request has already started
+        R->t_start = stats_clock();
+    }
+    return true;
+}
+
 // freeRequest()
-// frees the dynamically allocated memory
-// associated with the Request pointed to
-// by pReq.
+// closes the target file of the Request
+// pointed to by pReq and returns it to this
+// thread's pool, or frees it if the pool is
+// full.
 void freeRequest(Request *pReq) {
     if (pReq != NULL && *pReq != NULL) {
         Request R = *pReq;
-        free(R->hd_raw);
-        free(R);
-        close(R->tfd);
-        R = NULL;
+        end_request(R);
+        close_target(R); // before free, R is gone after
+        if (pooled < POOL_MAX) {
+            R->next_free = pool;
+            pool = R;
+            pooled++;
+        } else {
+            free(R);
+        }
+        *pReq = NULL;
     }
 }
 
@@ -136,6 +489,14 @@ char *getHeadBuf(Request R) {
     return R->hd_raw;
 }
 
+int getCFD(Request R) {
+    return R->cfd;
+}
+
+int getHeadLen(Request R) {
+    return R->hd_read;
+}
+
 char *getResponse(Request R) {
     return R->response;
 }
@@ -156,6 +517,12 @@ void setHeadLen(Request R, int hl) {
     R->hd_read = hl;
 }
 
+// has R's response say Connection: close and
+// the connection end after it.
+void dropKeepAlive(Request R) {
+    R->keep_alive = false;
+}
+
 // this will set the byte offset in R's
 // hd_raw buffer to \0 for string manipulation
 // purposes.
@@ -163,104 +530,225 @@ void stringify_hd(Request R, size_t offset) {
     R->hd_raw[offset] = '\0';
 }
 
+// have_header()
+// true once hd_raw holds a full header, or
+// is too full to ever hold one. only bytes
+// that arrived since the last call are
+// scanned.
+static bool have_header(Request R) {
+    return scan_header(&R->scan, R->hd_raw, R->hd_read) >= 0 || R->hd_read == BUF_SIZE;
+}
+
+// read_more()
+// does one read from R's connection onto the
+// end of hd_raw and returns what read() did.
+static ssize_t read_more(Request R) {
+    ssize_t n = read(R->cfd, R->hd_raw + R->hd_read, BUF_SIZE - R->hd_read);
+    if (n > 0) {
+        if (R->t_start == 0) {
+            R->t_start = stats_clock();
+        }
+        R->hd_read += n;
+        stringify_hd(R, R->hd_read);
+    }
+    return n;
+}
+
+// read_header()
+// blocks until hd_raw holds a full header,
+// reading from R's connection on top of any
+// bytes a previous request left behind.
+// returns the number of bytes buffered, 0 if
+// the peer closed with nothing buffered, or
+// -1 on a read error with nothing buffered.
+int read_header(Request R) {
+    while (!have_header(R)) {
+        ssize_t n = read_more(R);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return R->hd_read > 0 ? R->hd_read : (int) n;
+        }
+        if (request_deadline(R) <= wheel_clock()) { // a header trickling in forever
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    stats_phase(PH_READ, R->t_start);
+    return R->hd_read;
+}
+
+// body_deadline()
+// when R's body is to be given up on: a
+// second per MIN_RATE bytes moved, in or
+// out, after BODY_SECS from when its header
+// was done.
+static uint64_t body_deadline(Request R) {
+    return R->waiting + BODY_SECS * 1000000000ull
+        + (uint64_t) (body_in(R) + R->sent) * (1000000000ull / MIN_RATE);
+}
+
+// body_late()
+// true once R's body has missed its
+// deadline, for the blocking loops that move
+// it a piece at a time.
+static bool body_late(Request R) {
+    return body_deadline(R) <= wheel_clock();
+}
+
+// request_deadline()
+// a header is timed from when the last
+// request ended, or the connection opened,
+// and a body from when its header was done.
+uint64_t request_deadline(Request R) {
+    if (R->state != ST_READ_HEAD) {
+        return body_deadline(R);
+    }
+    uint64_t secs = R->hd_read > 0 ? HEADER_SECS : IDLE_SECS;
+    return R->waiting + secs * 1000000000ull;
+}
+
+// put_length()
+// writes "Content-Length: n" and the empty
+// line to buf, returning how many bytes that
+// took. digits are peeled off the back, no
+// printf on the hot path.
+static int put_length(char *buf, off_t n) {
+    char digits[24];
+    char *d = digits + sizeof(digits);
+    do {
+        *--d = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    int len = sizeof(content_length) - 1;
+    memcpy(buf, content_length, len);
+    buf[len++] = ' ';
+    memcpy(buf + len, d, digits + sizeof(digits) - d);
+    len += digits + sizeof(digits) - d;
+    memcpy(buf + len, RNRN, 4);
+    return len + 4;
+}
+
+// put_stamp()
+// copies R's validator lines to buf, then
+// Content-Encoding and Vary if they apply,
+// and returns how many bytes that took.
+static int put_stamp(Request R, char *buf) {
+    int len = strlen(R->etag);
+    memcpy(buf, R->etag, len);
+    memcpy(buf + len, R->modified, R->stamp_len - len);
+    len = R->stamp_len;
+    if (R->gzip && R->status != NOT_MOD) {
+        memcpy(buf + len, content_encoding, sizeof(content_encoding) - 1);
+        len += sizeof(content_encoding) - 1;
+    }
+    if (R->vary) {
+        memcpy(buf + len, vary, sizeof(vary) - 1);
+        len += sizeof(vary) - 1;
+    }
+    return len;
+}
+
+// part_header()
+// writes the boundary and Content-Range that
+// go before part k of a multipart response to
+// buf (PART_SIZE bytes), or the closing
+// boundary if k is past the last part.
+// returns how many bytes that took.
+static int part_header(Request R, int k, char *buf) {
+    if (k >= R->nranges) {
+        return snprintf(buf, PART_SIZE, "\r\n--%s--\r\n", R->boundary);
+    }
+    return snprintf(buf, PART_SIZE, "\r\n--%s\r\n%s %lld-%lld/%lld%s", R->boundary, content_range,
+        (long long) R->ranges[k].first, (long long) R->ranges[k].last, (long long) R->fcon_len,
+        RNRN);
+}
+
+// make_partial()
+// writes the header lines of a 206 to R's cl:
+// the validators, then the Content-Range and Content-Length of a
+// single range, or the multipart type and the
+// full length followed by the first part's
+// header. returns how many bytes that took.
+static int make_partial(Request R) {
+    char *p = R->cl + put_stamp(R, R->cl);
+    if (R->nranges == 1) {
+        p += sprintf(p, "%s %lld-%lld/%lld\r\n", content_range, (long long) R->ranges[0].first,
+            (long long) R->ranges[0].last, (long long) R->fcon_len);
+        return p - R->cl + put_length(p, R->fend - R->foff);
+    }
+    char part[PART_SIZE];
+    off_t total = 0;
+    for (int k = 0; k <= R->nranges; k++) {
+        total += part_header(R, k, part);
+        if (k < R->nranges) {
+            total += R->ranges[k].last - R->ranges[k].first + 1;
+        }
+    }
+    p += sprintf(p, "%s%s\r\n", multipart, R->boundary);
+    p += put_length(p, total);
+    return p - R->cl + part_header(R, 0, p);
+}
+
 // make_response()
-// puts an HTTP 1.1-formatted response with
-// respect to status code stat in the char
-// array pointed to by str.
+// points R's out iovec at the HTTP 1.1
+// response for its status code: the canned
+// status line, Connection: close if R is
+// closing, and either the canned rest or,
+// for a GET, its Content-Length (the file
+// follows separately). a 206 or 416 gets its
+// Content-Range too. returns the total
+// length.
 int make_response(Request R) {
-    char *str = R->response;
-    size_t str_len = HEAD_SIZE + 23;
-    size_t msg_len = 0;
-    char stat_phrase[23];
-    char msg[23];
-    int ret;
-    int stat = R->status;
-    switch (stat) { // set pointers to status phrase strings and
-    case OK: { // get size of message depending on status code
-        strncpy(stat_phrase, ok, sizeof(stat_phrase));
-        if (R->method == GET) {
-            msg_len = R->fcon_len; // length of target file
-        } else {
-            msg_len = strlen(ok_msg);
-            strncpy(msg, ok_msg, sizeof(msg));
-        }
-        break;
-    }
-    case CREATED: {
-        strncpy(stat_phrase, created, sizeof(stat_phrase));
-        msg_len = strlen(created_msg);
-        strncpy(msg, created_msg, sizeof(msg));
-        break;
-    }
-    case BAD_REQ: {
-        strncpy(stat_phrase, bad_req, sizeof(stat_phrase));
-        msg_len = strlen(bad_req_msg);
-        strncpy(msg, bad_req_msg, sizeof(msg));
-        break;
-    }
-    case FORBIDDEN: {
-        strncpy(stat_phrase, forbidden, sizeof(stat_phrase));
-        msg_len = strlen(forbidden_msg);
-        strncpy(msg, forbidden_msg, sizeof(msg));
-        break;
-    }
-    case NOT_FOUND: {
-        strncpy(stat_phrase, not_found, sizeof(not_found));
-        msg_len = strlen(not_found_msg);
-        strncpy(msg, not_found_msg, sizeof(msg));
-        break;
-    }
-    case SERV_ERR: {
-        strncpy(stat_phrase, serv_err, sizeof(stat_phrase));
-        msg_len = strlen(serv_err_msg);
-        strncpy(msg, serv_err_msg, sizeof(msg));
-        break;
-    }
-    case NOT_IMPD: {
-        strncpy(stat_phrase, not_impd, sizeof(stat_phrase));
-        msg_len = strlen(not_impd_msg);
-        strncpy(msg, not_impd_msg, sizeof(msg));
-        break;
-    }
-    case VRSN_NSPD: {
-        strncpy(stat_phrase, vrsn_nspd, sizeof(stat_phrase));
-        msg_len = strlen(vrsn_nspd_msg);
-        strncpy(msg, vrsn_nspd_msg, sizeof(msg));
-        break;
-    }
-    default: {
-        warnx("INVALID STATUS CODE");
-        break;
-    }
-    }
-
-    // make the string and return bytes written (not incl. \n)
-    if (R->method == GET && stat == OK) {
-        ret = snprintf(str, str_len, "%s %d %s\r\n%s %d%s", http_vers, stat, stat_phrase,
-            content_length, (int) msg_len, RNRN);
+    const Reply *r = reply(R->status);
+    R->out[0].iov_base = (char *) r->line;
+    R->out[0].iov_len = r->line_len;
+    R->out[1].iov_base = (char *) conn_close;
+    R->out[1].iov_len = R->keep_alive ? 0 : sizeof(conn_close) - 1;
+    if (R->method == GET && R->status == OK) {
+        int len = put_stamp(R, R->cl);
+        R->out[2].iov_base = R->cl;
+        R->out[2].iov_len = len + put_length(R->cl + len, R->fcon_len);
+    } else if (R->status == PARTIAL) {
+        R->out[2].iov_base = R->cl;
+        R->out[2].iov_len = make_partial(R);
+    } else if (R->status == NOT_MOD) { // no body, so no length either
+        int len = put_stamp(R, R->cl);
+        memcpy(R->cl + len, "\r\n", 2);
+        R->out[2].iov_base = R->cl;
+        R->out[2].iov_len = len + 2;
+    } else if (R->status == RANGE_NSAT) {
+        int len = sprintf(R->cl, "%s */%lld\r\n", content_range, (long long) R->fcon_len);
+        memcpy(R->cl + len, r->rest, r->rest_len);
+        R->out[2].iov_base = R->cl;
+        R->out[2].iov_len = len + r->rest_len;
     } else {
-        ret = snprintf(str, str_len, "%s %d %s\r\n%s %d%s%s", http_vers, stat, stat_phrase,
-            content_length, (int) msg_len, RNRN, msg);
+        R->out[2].iov_base = (char *) r->rest;
+        R->out[2].iov_len = r->rest_len;
     }
-    return ret;
+    R->resp_off = 0;
+    R->resp_len = R->out[0].iov_len + R->out[1].iov_len + R->out[2].iov_len;
+    return R->resp_len;
 }
 
-// parse_request()
-// will attempt to parse a valid HTTP 1.1
-// request header from the hd_raw field of
-// R. if a valid header is present in R's
-// hd_raw, the command, fname, and con_len
-// (if applicable) fields will be filled with
-// the respective fields. On success, the status
-// field of R is NOT touched and will remain at
-// its initialzed value. On failure, such as
-// Bad Request, Version Not Supported, or Not
-// Implemented, the corresponding HTTP status
-// code value will be placed in R's status field.
-// A failed parse may result in some, but not all,
-// of R's fields being set, depending on where the
-// error appears in the request.
-void parse_request(Request R) {
+// keep_header()
+// notes where the value of a header in kept
+// sits, if key names one.
+static void keep_header(Request R, const char *key, int key_len, int at, int len) {
+    for (int k = 0; k < NKEPT; k++) {
+        if ((int) strlen(kept[k]) == key_len && strncasecmp(key, kept[k], key_len) == 0) {
+            R->kept_at[k] = at;
+            R->kept_len[k] = len;
+            return;
+        }
+    }
+}
+
+// parse_header()
+// regex matcher behind parse_request(). expects
+// hd_raw to end right after the header.
+static void parse_header(Request R) {
     char err_buf[100];
     char *buf = R->hd_raw;
     int i = 0;
@@ -276,6 +764,12 @@ void parse_request(Request R) {
 
     // attempt to match request line
     int rl_match = regexec(pregRL, buf, 4, pmRL, 0);
+    if (rl_match == 0 && pmRL[0].rm_so != 0) { // request line must come first
+        R->status = BAD_REQ;
+        regfree(pregRL);
+        regfree(pregHFL);
+        return;
+    }
     if (rl_match != 0) {
         regerror(rl_match, pregRL, err_buf, sizeof(err_buf));
         warnx("%s", err_buf);
@@ -355,7 +849,7 @@ void parse_request(Request R) {
             // make a string of key: value
             size_t key_len = pmHFL[1].rm_eo - pmHFL[1].rm_so;
             char key[key_len + 1];
-            strncpy(key, buf + i, req_len);
+            strncpy(key, buf + i, key_len);
             key[key_len] = '\0';
 
             size_t val_len = pmHFL[2].rm_eo - pmHFL[2].rm_so;
@@ -365,11 +859,23 @@ void parse_request(Request R) {
 
             // check if field is content length and
             // store info if yes
-            if (strcmp(key, content_length) == 0) {
-                int cl = atoi(val);
-                R->con_len = cl;
+            if (strcasecmp(key, content_length) == 0) {
+                R->con_len = strtoll(val, NULL, 10);
+            }
+
+            // the client can opt out of keep-alive
+            if (strcasecmp(key, connection) == 0 && strcasecmp(val, "close") == 0) {
+                R->keep_alive = false;
+            }
+
+            // chunked is the only coding we can undo
+            if (strcasecmp(key, transfer_encoding) == 0) {
+                R->coding = (strcasecmp(val, "chunked") == 0) ? TE_CHUNKED : TE_OTHER;
             }
 
+            // these are only looked at once the file is open
+            keep_header(R, key, key_len - 1, i + pmHFL[2].rm_so, val_len);
+
             // update i
             i += pmHFL[0].rm_eo;
         }
@@ -381,7 +887,7 @@ void parse_request(Request R) {
     }
 
     // check if put request w no content length field
-    if (strcmp(cmd, put) == 0 && R->con_len == -1) {
+    if (strcmp(cmd, put) == 0 && R->con_len == -1 && R->coding == TE_NONE) {
         R->status = BAD_REQ;
     }
 
@@ -395,120 +901,1798 @@ breakout:
     return;
 }
 
-// handle_request()
-// prepares Request for being executed on
-// GET or PUT methods, or prepares them to
-// return an appropriate error response.
-// Executes the method if all goes well
-// and produces and sends a response to
-// the socket in all cases.
-void handle_request(Request R) {
-    bool get = false;
-    bool put = false;
-    if (R->method == GET) { // find out which method
-        get = true;
+// finish_parse()
+// bookkeeping shared by both parsers once
+// the header has been looked at.
+static void finish_parse(Request R) {
+    // the next request starts after this one's header,
+    // until a PUT body claims the bytes in between
+    R->next_off = R->hd_eo;
+
+    // a negative length can't frame a body
+    if (R->status == 0 && R->con_len < -1) {
+        R->status = BAD_REQ;
     }
-    if (R->method == PUT && R->con_len != -1) {
-        put = true;
+
+    // a body is framed by a Content-Length or by chunks,
+    // never both, and only a PUT has one
+    if (R->status == 0 && R->coding == TE_OTHER) {
+        R->status = NOT_IMPD;
+    } else if (R->status == 0 && R->coding == TE_CHUNKED
+               && (R->con_len != -1 || R->method != PUT)) {
+        R->status = BAD_REQ;
     }
-    char *fn = R->fname;
 
-    // set up for get
-    // try to open file and set status accordingly
-    if (get) {
-        DIR *d;
-        if ((d = opendir(fn)) != NULL) { // check if is dir
-            R->status = FORBIDDEN;
-        } else if (access(fn, F_OK) != 0) { // check for existence
-            R->status = NOT_FOUND;
-        } else if (access(fn, R_OK) != 0) { // check for permissions
-            R->status = FORBIDDEN;
-        } else {
-            int fd = open(fn, O_RDONLY);
-            if (fd < 0) {
-                R->status = SERV_ERR;
-            } else {
-                R->status = OK;
-                R->tfd = fd; // store fd in struct so get() can access
-                struct stat st; // find out file size and store in struct
-                fstat(fd, &st);
-                R->fcon_len = (int) st.st_size;
-            }
-        }
+    // can't trust the framing of anything that failed to parse
+    if (R->status != 0) {
+        R->keep_alive = false;
     }
+}
 
-    // set up for put
-    // try to open file, create if need be, and set status
-    if (put) {
+// parse_request_regex()
+// the original regex-based parser, kept as
+// the reference parse_request() is measured
+// and checked against. same contract as
+// parse_request().
+void parse_request_regex(Request R) {
+    // hide everything past the header from the regexes
+    char *end = strstr(R->hd_raw, RNRN);
+    char saved = NUL;
+    if (end != NULL) {
+        end += strlen(RNRN);
+        saved = *end;
+        *end = NUL;
+    }
+    parse_header(R);
+    if (end != NULL) {
+        *end = saved;
+    }
+    finish_parse(R);
+}
 
-        int fd;
-        if (access(fn, F_OK) == 0) { // file exists case
+// character classes of the request grammar,
+// matching the ones in rl and hf
+static inline bool is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
 
-            DIR *d;
-            if ((d = opendir(fn)) != NULL) { // check if is dir
-                R->status = FORBIDDEN;
-            } else if (access(fn, W_OK) != 0) { // check for permission
-                R->status = FORBIDDEN;
-            } else {
-                fd = open(fn, O_RDWR | O_TRUNC); // truncate and get fd
-                if (fd < 0) {
-                    R->status = SERV_ERR;
-                } else {
-                    R->status = OK; // store in struct and set status
-                    R->tfd = fd;
-                }
-            }
-        } else { // file dne case
-            fd = open(fn, O_RDWR | O_CREAT, 0666); // create it
-            if (fd < 0) {
-                R->status = SERV_ERR;
-            } else {
-                R->status = CREATED; // store in struct and set status
-                R->tfd = fd;
+static inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline bool is_token(char c) { // keys and uris
+    return is_alpha(c) || is_digit(c) || c == '.' || c == '-';
+}
+
+static inline bool is_print(char c) { // values
+    return c >= ' ' && c <= '~';
+}
+
+// parse_request()
+// will attempt to parse a valid HTTP 1.1
+// request header from the hd_raw field of
+// R. if a valid header is present in R's
+// hd_raw, the command, fname, and con_len
+// (if applicable) fields will be filled with
+// the respective fields. On success, the status
+// field of R is NOT touched and will remain at
+// its initialzed value. On failure, such as
+// Bad Request, Version Not Supported, or Not
+// Implemented, the corresponding HTTP status
+// code value will be placed in R's status field.
+// A failed parse may result in some, but not all,
+// of R's fields being set, depending on where the
+// error appears in the request. bytes after the
+// header (a body or pipelined requests) are
+// never looked at.
+//
+// this is a single left-to-right pass over
+// hd_raw with no copies besides fname. it
+// leans on hd_raw being nul-terminated: nul
+// is in none of the character classes, so
+// running off the end of the read bytes
+// always fails a check before going further.
+// when the scanner has already vetted every
+// byte and found every line end, header
+// values are measured, not walked.
+void parse_request(Request R) {
+    const char *buf = R->hd_raw;
+    const char *p = buf;
+    HeaderScan *S = &R->scan;
+    scan_header(S, buf, R->hd_read); // no-op if have_header() got there first
+    bool vetted = S->end >= 0 && S->clean && S->nlines <= MAX_LINES;
+    int line = 1; // crlf[0] ends the request line
+
+    // request line: method
+    const char *meth = p;
+    while (is_alpha(*p)) {
+        p++;
+    }
+    int meth_len = p - meth;
+    if (meth_len < 1 || meth_len > 8 || *p++ != ' ') {
+        goto bad;
+    }
+
+    // uri, minus its leading slash
+    if (*p++ != '/') {
+        goto bad;
+    }
+    const char *uri = p;
+    while (is_token(*p)) {
+        p++;
+    }
+    int uri_len = p - uri;
+    if (uri_len < 1 || uri_len > 63 || *p++ != ' ') {
+        goto bad;
+    }
+
+    // version, HTTP/d.d
+    const char *vers = p;
+    if (strncmp(p, "HTTP/", 5) != 0 || !is_digit(p[5]) || p[6] != '.' || !is_digit(p[7])
+        || p[8] != '\r' || p[9] != '\n') {
+        goto bad;
+    }
+    p += 10;
+
+    // check to see if command field is valid
+    if (meth_len == 3 && strncmp(meth, get, 3) == 0) {
+        R->method = GET;
+    } else if (meth_len == 3 && strncmp(meth, put, 3) == 0) {
+        R->method = PUT;
+    } else {
+        R->status = NOT_IMPD;
+        goto done;
+    }
+
+    // check to see if version is 1.1
+    if (strncmp(vers, http_vers, 8) != 0) {
+        R->method = NOT_SET;
+        R->status = VRSN_NSPD;
+        goto done;
+    }
+
+    // set cmd and fname fields of Request
+    memcpy(R->command, meth, 3);
+    memcpy(R->fname, uri, uri_len);
+    R->fname[uri_len] = NUL;
+
+    // header fields, "key: value\r\n", until the empty line
+    while (p[0] != '\r' || p[1] != '\n') {
+        const char *key = p;
+        while (is_token(*p)) {
+            p++;
+        }
+        int key_len = p - key;
+        if (key_len < 1 || key_len > 128 || p[0] != ':' || p[1] != ' ') {
+            goto bad;
+        }
+        p += 2;
+        const char *val = p;
+        if (vetted) {
+            p = buf + S->crlf[line]; // printable all the way to its CRLF
+        } else {
+            while (is_print(*p)) {
+                p++;
             }
         }
-        if (R->status == OK || R->status == CREATED) {
-            put_ex(R);
+        line++;
+        int val_len = p - val;
+        if (val_len < 1 || val_len > 128 || p[0] != '\r' || p[1] != '\n') {
+            goto bad;
+        }
+        p += 2;
+
+        // key_len leaves off the colon that content_length
+        // and connection carry
+        if (key_len == (int) strlen(content_length) - 1
+            && strncasecmp(key, content_length, key_len) == 0) {
+            R->con_len = strtoll(val, NULL, 10); // stops at the \r
+        } else if (key_len == (int) strlen(connection) - 1
+                   && strncasecmp(key, connection, key_len) == 0 && val_len == 5
+                   && strncasecmp(val, "close", 5) == 0) {
+            R->keep_alive = false;
+        } else if (key_len == (int) strlen(transfer_encoding) - 1
+                   && strncasecmp(key, transfer_encoding, key_len) == 0) {
+            bool chunked = val_len == 7 && strncasecmp(val, "chunked", 7) == 0;
+            R->coding = chunked ? TE_CHUNKED : TE_OTHER;
+        } else {
+            keep_header(R, key, key_len, val - buf, val_len); // looked at once the file is open
         }
     }
 
-    // make response and write to sock
-    int resp_len = make_response(R);
-    write_n_bytes(R->cfd, R->response, resp_len);
+    // check if put request w no content length field
+    if (R->method == PUT && R->con_len == -1 && R->coding == TE_NONE) {
+        R->status = BAD_REQ;
+    }
+
+    // set end of header offset
+    R->hd_eo = (p + 2) - buf;
+    goto done;
+
+bad:
+    R->status = BAD_REQ;
+done:
+    finish_parse(R);
+}
 
-    // perform get execution
-    if (get) {
-        get_ex(R);
+// flat_header()
+// copies the header make_response() would
+// send R on a keep-alive connection into R's
+// response buffer, for the cache. returns
+// its length.
+static int flat_header(Request R) {
+    bool keep_alive = R->keep_alive;
+    R->keep_alive = true;
+    int hdr_len = make_response(R);
+    R->keep_alive = keep_alive;
+    char *p = R->response;
+    for (int i = 0; i < 3; i++) {
+        memcpy(p, R->out[i].iov_base, R->out[i].iov_len);
+        p += R->out[i].iov_len;
     }
+    return hdr_len;
 }
 
-// private functions
+// fill_cache()
+// offers the GET target R just opened to the
+// cache, behind the header make_response()
+// would send on a keep-alive connection. if
+// its bytes are taken R is served from memory
+// and the file is closed early. failing that,
+// the cache may keep the file open for the
+// next GET, and R borrows it from there.
+static void fill_cache(Request R, const struct stat *st, unsigned long gen) {
+    if (!cache_enabled()) {
+        return;
+    }
+    int hdr_len = flat_header(R);
+    R->hit = cache_fill(R->fname, R->tfd, st, gen, R->response, hdr_len);
+    if (R->hit != NULL) {
+        close(R->tfd);
+        R->tfd = -1;
+        return;
+    }
+    R->hit = cache_hold(R->fname, R->tfd, st, gen);
+}
 
-// get()
-void get_ex(Request R) {
-    pass_n_bytes(R->tfd, R->cfd, R->fcon_len);
+// in_memory()
+// true if R's whole response, body and all,
+// is the bytes of a cache entry.
+static bool in_memory(Request R) {
+    return R->hit != NULL && R->tfd < 0 && R->status == OK;
 }
 
-// put()
-int put_ex(Request R) {
-    int cl = R->con_len;
-    int buf_remainder = R->hd_read - R->hd_eo;
-    int transferred = 0, total = 0;
-    if (cl > buf_remainder) { // cl large, need to read from buf AND sock case
-        transferred = write_n_bytes(R->tfd, R->hd_raw + R->hd_eo, buf_remainder);
-        cl -= transferred;
-        total += transferred;
-        while (cl > 0) {
-            transferred = pass_n_bytes(R->cfd, R->tfd, cl);
-            cl -= transferred;
-            total += transferred;
+// file_follows()
+// true if the target file goes out after
+// R's response header.
+static bool file_follows(Request R) {
+    return R->method == GET && (R->status == OK || R->status == PARTIAL) && !in_memory(R)
+           && R->part < R->nranges;
+}
+
+// start_part()
+// points foff and fend at the range of the
+// file that follows out.
+static void start_part(Request R) {
+    if (R->part < R->nranges) {
+        R->foff = R->ranges[R->part].first;
+        R->fend = R->ranges[R->part].last + 1;
+    }
+}
+
+// next_part()
+// moves R on once the range of the file
+// after out has gone. a multipart response
+// then points out at the next part's header,
+// or the closing boundary after the last.
+// returns false if nothing is left to send.
+static bool next_part(Request R) {
+    R->part++;
+    if (R->status != PARTIAL || R->nranges < 2 || R->part > R->nranges) {
+        return false;
+    }
+    R->out[0].iov_base = R->part_hdr;
+    R->out[0].iov_len = part_header(R, R->part, R->part_hdr);
+    R->out[1].iov_len = R->out[2].iov_len = 0;
+    R->resp_off = 0;
+    R->resp_len = R->out[0].iov_len;
+    start_part(R);
+    return true;
+}
+
+// make_hit()
+// make_response() for a response that is in
+// memory: points R's out iovec at the cached
+// header and body, with Connection: close
+// slotted in after the status line if R
+// needs it.
+static void make_hit(Request R) {
+    size_t len;
+    int hdr_len;
+    char *data = (char *) cache_data(R->hit, &len, &hdr_len);
+    size_t line = (char *) memchr(data, '\n', hdr_len) + 1 - data;
+    R->out[0].iov_base = data;
+    R->out[0].iov_len = line;
+    R->out[1].iov_base = (char *) conn_close;
+    R->out[1].iov_len = R->keep_alive ? 0 : sizeof(conn_close) - 1;
+    R->out[2].iov_base = data + line;
+    R->out[2].iov_len = len - line;
+    R->resp_off = 0;
+    R->resp_len = len + R->out[1].iov_len;
+}
+
+// out_iov()
+// points iov at what is left of R's out
+// iovec and returns how many entries that
+// took, 0 once everything has been sent.
+static int out_iov(Request R, struct iovec iov[3]) {
+    off_t skip = R->resp_off;
+    int cnt = 0;
+    for (int i = 0; i < 3; i++) {
+        if (skip >= (off_t) R->out[i].iov_len) {
+            skip -= R->out[i].iov_len;
+            continue;
+        }
+        iov[cnt].iov_base = (char *) R->out[i].iov_base + skip;
+        iov[cnt].iov_len = R->out[i].iov_len - skip;
+        skip = 0;
+        cnt++;
+    }
+    return cnt;
+}
+
+// send_out()
+// one sendmsg() of what is left of R's out
+// iovec, so a response goes out in a single
+// call and, when it's small, one packet.
+// returns what sendmsg() did, or 0 once
+// everything has been sent.
+static ssize_t send_out(Request R, int flags) {
+    struct iovec iov[3];
+    struct msghdr msg = { 0 };
+    int cnt = out_iov(R, iov);
+    if (cnt == 0) {
+        return 0;
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+    ssize_t n = sendmsg(R->cfd, &msg, flags | MSG_NOSIGNAL);
+    if (n > 0) {
+        R->resp_off += n;
+        R->sent += n;
+    }
+    return n;
+}
+
+// range_num()
+// reads the digits at p into *v, saturating
+// rather than overflowing. returns the end of
+// them, or NULL if there are none.
+static const char *range_num(const char *p, const char *end, off_t *v) {
+    const char *start = p;
+    *v = 0;
+    for (; p < end && is_digit(*p); p++) {
+        *v = *v > (INT64_MAX - 9) / 10 ? INT64_MAX : *v * 10 + (*p - '0');
+    }
+    return p == start ? NULL : p;
+}
+
+// skip_ows()
+// past the spaces and tabs at p.
+static const char *skip_ows(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+// apply_range()
+// turns R's GET of an opened file into the
+// list of ranges of it to send. without a
+// usable Range header that is the whole file.
+// a "bytes=" Range with any satisfiable spec
+// makes a 206 of those, one with none a 416.
+// a Range that doesn't parse, or has more
+// than RANGE_MAX specs, is ignored, as HTTP
+// allows.
+static void apply_range(Request R) {
+    R->ranges[0] = (Range) { 0, R->fcon_len - 1 };
+    R->nranges = 1;
+    R->part = 0;
+    start_part(R);
+    if (R->kept_at[K_RANGE] == 0) {
+        return;
+    }
+    const char *p = R->hd_raw + R->kept_at[K_RANGE], *end = p + R->kept_len[K_RANGE];
+    if (R->kept_len[K_RANGE] < 6 || strncasecmp(p, "bytes=", 6) != 0) {
+        return;
+    }
+    Range got[RANGE_MAX];
+    int n = 0, specs = 0;
+    off_t size = R->fcon_len;
+    for (p += 6;; p++) {
+        off_t first, last = INT64_MAX;
+        p = skip_ows(p, end);
+        if (p < end && *p == '-') { // suffix, the last n bytes
+            if ((p = range_num(p + 1, end, &last)) == NULL) {
+                return;
+            }
+            first = size > last ? size - last : 0;
+            last = last > 0 ? size - 1 : -1; // -0 and empty files can't be had
+        } else {
+            if ((p = range_num(p, end, &first)) == NULL || p >= end || *p++ != '-') {
+                return;
+            }
+            if (p < end && is_digit(*p)) {
+                p = range_num(p, end, &last);
+                if (last < first) {
+                    return;
+                }
+            }
+            if (last >= size) {
+                last = size - 1;
+            }
+        }
+        if (++specs > RANGE_MAX) {
+            return;
+        }
+        if (first < size && first <= last) {
+            got[n++] = (Range) { first, last };
+        }
+        p = skip_ows(p, end);
+        if (p == end) {
+            break;
+        }
+        if (*p != ',') {
+            return;
+        }
+    }
+    if (n == 0) {
+        R->status = RANGE_NSAT;
+        R->nranges = 0;
+        return;
+    }
+    static atomic_ulong seq = 0;
+    memcpy(R->ranges, got, n * sizeof(Range));
+    R->nranges = n;
+    R->status = PARTIAL;
+    snprintf(R->boundary, sizeof(R->boundary), "%08lx%08lx", (unsigned long) getpid(),
+        atomic_fetch_add(&seq, 1));
+    start_part(R);
+}
+
+// stamp()
+// makes the ETag and Last-Modified lines of
+// a GET target from its fstat(). the tag is
+// inode, size and mtime to the nanosecond,
+// and a PUT renames a new inode into place,
+// so no two versions of a file share one.
+static void stamp(Request R, const struct stat *st) {
+    struct tm tm;
+    int len = snprintf(R->etag, ETAG_SIZE, "%s \"%lx-%llx-%llx%s\"\r\n", etag,
+        (unsigned long) st->st_ino, (unsigned long long) st->st_size,
+        (unsigned long long) st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec,
+        R->gzip ? "-gz" : "");
+    int mlen = sprintf(R->modified, "%s ", last_modified);
+    mlen += strftime(R->modified + mlen, DATE_SIZE - mlen - 2, HTTP_DATE,
+        gmtime_r(&st->st_mtim.tv_sec, &tm));
+    memcpy(R->modified + mlen, "\r\n", 2);
+    R->stamp_len = len + mlen + 2;
+    R->vary = gzip_worth(st->st_size);
+}
+
+// gzip_key()
+// the cache key of the gzip variant of the
+// version of a file st describes.
+static void gzip_key(const struct stat *st, char *key) {
+    snprintf(key, GZKEY_SIZE, "gz:%lx-%llx-%llx", (unsigned long) st->st_ino,
+        (unsigned long long) st->st_size,
+        (unsigned long long) st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec);
+}
+
+// wants_gzip()
+// true if R's GET of a file with attributes
+// st should look for a gzip variant.
+static bool wants_gzip(Request R, const struct stat *st) {
+    return gzip_worth(st->st_size) && R->kept_at[K_RANGE] == 0 && R->kept_at[K_ACCEPT_ENC] != 0
+           && gzip_accepted(R->hd_raw + R->kept_at[K_ACCEPT_ENC], R->kept_len[K_ACCEPT_ENC]);
+}
+
+// variant_header()
+// flat_header() for R's gzip variant of a
+// file with attributes st, len bytes long.
+// leaves R set up to send the variant.
+static int variant_header(Request R, const struct stat *st, off_t len) {
+    R->gzip = true;
+    R->fcon_len = len;
+    stamp(R, st);
+    return flat_header(R);
+}
+
+// open_sidecar()
+// opens fname.gz, the precompressed copy of
+// R's target with attributes st, if there is
+// one no older than the target. returns its
+// fd, with its attributes in *sst, or -1.
+static int open_sidecar(Request R, const struct stat *st, struct stat *sst) {
+    char name[PATH_MAX + 3];
+    snprintf(name, sizeof(name), "%s.gz", R->fname);
+    int fd = openat(root_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, sst) != 0 || !S_ISREG(sst->st_mode) || sst->st_mtim.tv_sec < st->st_mtim.tv_sec
+        || (sst->st_mtim.tv_sec == st->st_mtim.tv_sec
+            && sst->st_mtim.tv_nsec < st->st_mtim.tv_nsec)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// make_variant()
+// the miss path of use_variant(): caches the
+// sidecar under key if there is one, or else
+// compresses the file. a file that doesn't
+// compress well gets an empty entry, so it
+// isn't tried again. returns the entry, or
+// NULL, with *side set to a sidecar that
+// could not be cached (-1 if none).
+static CacheEntry make_variant(Request R, const struct stat *st, const char *key, int *side,
+    struct stat *sst) {
+    unsigned long gen = cache_gen(key); // before either file is looked at
+    int fd = open_sidecar(R, st, sst);
+    if (fd >= 0) {
+        CacheEntry v = NULL;
+        if (cache_enabled()) {
+            int hdr_len = variant_header(R, st, sst->st_size);
+            v = cache_fill(key, fd, sst, gen, R->response, hdr_len);
+            if (v != NULL) {
+                close(fd);
+                return v;
+            }
+            v = cache_hold(key, fd, sst, gen);
+        }
+        *side = (v == NULL) ? fd : -1;
+        return v;
+    }
+    if (cache_room() == 0 || st->st_size > GZIP_MAX) {
+        return NULL;
+    }
+
+    // the plain bytes may already be in memory
+    size_t len = st->st_size, have;
+    int hdr_len;
+    const char *src = NULL;
+    char *buf = NULL;
+    if (R->hit != NULL && (src = cache_data(R->hit, &have, &hdr_len)) != NULL) {
+        src += hdr_len;
+    } else if ((buf = malloc(len + 1)) != NULL) {
+        size_t got = 0;
+        ssize_t n = 1;
+        while (got < len && (n = pread(R->tfd, buf + got, len - got, got)) > 0) {
+            got += n;
+        }
+        src = (got == len) ? buf : NULL;
+    }
+    char *z = (src != NULL) ? gzip_deflate(src, len, &have) : NULL;
+    free(buf);
+    CacheEntry v = NULL;
+    if (z != NULL) {
+        hdr_len = variant_header(R, st, have);
+        v = cache_put(key, st, gen, R->response, hdr_len, z, have);
+        free(z);
+    }
+    if (v == NULL && src != NULL) { // not worth it, or too big to keep
+        cache_release(cache_put(key, st, gen, "", 0, "", 0));
+    }
+    return v;
+}
+
+// use_variant()
+// switches R's GET of a file with attributes
+// st to its gzip variant, if it has one worth
+// sending: one cached by an earlier GET, a
+// sidecar named fname.gz no older than the
+// file, or, with memory in the cache, the
+// file compressed now and cached for the
+// next GET. variants are cached under the file's
+// identity rather than its name, so none can
+// outlive the version it was made from.
+static void use_variant(Request R, const struct stat *st) {
+    char key[GZKEY_SIZE];
+    struct stat sst;
+    int side = -1;
+    gzip_key(st, key);
+    CacheEntry v = cache_get(key);
+    if (v == NULL) {
+        v = make_variant(R, st, key, &side, &sst);
+    }
+    size_t len = 0;
+    int hdr_len = 0;
+    if (v != NULL && cache_data(v, &len, &hdr_len) != NULL && len == 0) {
+        cache_release(v); // known not to be worth it
+        v = NULL;
+    }
+    if (v == NULL && side < 0) { // back to the plain file
+        R->gzip = false;
+        R->fcon_len = st->st_size;
+        R->stamp_len = 0;
+        return;
+    }
+    close_target(R);
+    R->hit = v;
+    R->tfd = (v != NULL) ? cache_file(v, &sst) : side;
+    R->fcon_len = (R->tfd >= 0) ? sst.st_size : (off_t) (len - hdr_len);
+    R->gzip = true;
+    R->stamp_len = 0; // validate() makes the variant's if it needs them
+}
+
+// tag_matches()
+// true if the comma separated list of entity
+// tags at p (len bytes) holds R's, or is "*".
+// weak tags compare equal to the strong tag
+// of the same bytes.
+static bool tag_matches(Request R, const char *p, int len) {
+    const char *end = p + len;
+    const char *tag = strchr(R->etag, '"'); // past "ETag: "
+    int tag_len = strchr(tag + 1, '"') + 1 - tag;
+    while (p < end) {
+        p = skip_ows(p, end);
+        if (p < end && *p == '*') {
+            return true;
+        }
+        if (end - p > 2 && strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        if (end - p >= tag_len && strncmp(p, tag, tag_len) == 0
+            && (p + tag_len == end || p[tag_len] == ',' || p[tag_len] == ' ')) {
+            return true;
+        }
+        while (p < end && *p != ',') {
+            p++;
+        }
+        p++;
+    }
+    return false;
+}
+
+// modified_since()
+// false if the HTTP-date at p is no earlier
+// than mtime (and not in the future). dates
+// that don't parse count as modified.
+static bool modified_since(const char *p, time_t mtime) {
+    struct tm tm = { 0 };
+    if (strptime(p, HTTP_DATE, &tm) == NULL) {
+        return true;
+    }
+    time_t since = timegm(&tm);
+    return since > time(NULL) || mtime > since;
+}
+
+// validate()
+// applies R's conditional headers to its GET
+// of a file with attributes st, then its
+// Range. a match for If-None-Match (or, when
+// that is absent, an If-Modified-Since the
+// file is no newer than) makes a 304. an
+// If-Range that is not the current ETag or
+// Last-Modified drops the Range, so a resumed
+// download of a changed file starts over.
+static void validate(Request R, const struct stat *st) {
+    bool cond = false;
+    for (int k = K_IF_RANGE; k < NKEPT; k++) {
+        cond |= R->kept_at[k] != 0;
+    }
+    if (!cond) {
+        if (R->stamp_len == 0 && !in_memory(R)) { // the header is made per request
+            stamp(R, st);
+        }
+        apply_range(R);
+        return;
+    }
+    if (R->stamp_len == 0) {
+        stamp(R, st);
+    }
+    const char *val[NKEPT];
+    for (int k = 0; k < NKEPT; k++) {
+        val[k] = R->hd_raw + R->kept_at[k];
+    }
+    bool fresh = false;
+    if (R->kept_at[K_IF_NONE_MATCH] != 0) {
+        fresh = tag_matches(R, val[K_IF_NONE_MATCH], R->kept_len[K_IF_NONE_MATCH]);
+    } else if (R->kept_at[K_IF_MOD_SINCE] != 0) {
+        fresh = !modified_since(val[K_IF_MOD_SINCE], st->st_mtim.tv_sec);
+    }
+    if (fresh) {
+        R->status = NOT_MOD;
+        return;
+    }
+    if (R->kept_at[K_RANGE] != 0 && R->kept_at[K_IF_RANGE] != 0) {
+        const char *v = val[K_IF_RANGE];
+        int len = R->kept_len[K_IF_RANGE];
+        const char *tag = strchr(R->etag, '"');
+        const char *date = R->modified + sizeof(last_modified); // past "Last-Modified: "
+        bool same = (*v == '"') ? (strncmp(v, tag, len) == 0 && tag[len] == '\r')
+                                : (strncmp(v, date, len) == 0 && date[len] == '\r');
+        if (!same) {
+            R->kept_at[K_RANGE] = 0;
+        }
+    }
+    apply_range(R);
+}
+
+// prepare_request()
+// opens the target of a parsed GET or PUT
+// and sets R's status accordingly. does
+// nothing if the parse already failed.
+// targets are opened relative to root_fd,
+// and why an open failed decides the status,
+// so a lookup costs an openat() and, for a
+// GET, an fstat(). uris never hold a '/', so
+// nothing outside the root can be named.
+static void prepare_request(Request R) {
+    if (R->status != 0) { // parse error, nothing to open
+        return;
+    }
+    char *fn = R->fname;
+
+    // set up for get
+    // try to open file and set status accordingly. ranges
+    // are sent from the file, so a ranged GET only takes
+    // a cache entry that holds one open
+    if (R->method == GET) {
+        bool ranged = R->kept_at[K_RANGE] != 0;
+        bool in_cache = false;
+        if ((R->hit = cache_get(fn)) != NULL) { // no filesystem trip at all
+            struct stat st;
+            int fd = cache_file(R->hit, &st); // -1 if the bytes are in memory
+            if (fd >= 0 || !ranged) {
+                R->status = OK;
+                R->tfd = fd;
+                R->fcon_len = st.st_size;
+                if (wants_gzip(R, &st)) {
+                    use_variant(R, &st);
+                }
+                validate(R, &st);
+                return;
+            }
+            cache_release(R->hit);
+            R->hit = NULL;
+            in_cache = true;
+        }
+        unsigned long gen = cache_gen(fn); // before the file is looked at
+        int fd = openat(root_fd, fn, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0) {
+            R->status = (errno == ENOENT) ? NOT_FOUND : (errno == EACCES) ? FORBIDDEN : SERV_ERR;
+        } else if (fstat(fd, &st) != 0) {
+            close(fd);
+            R->status = SERV_ERR;
+        } else if (!S_ISREG(st.st_mode)) { // directories and the like
+            close(fd);
+            R->status = FORBIDDEN;
+        } else {
+            R->status = OK;
+            R->tfd = fd; // store fd in struct so get() can access
+            R->fcon_len = st.st_size;
+            stamp(R, &st); // before the cache copies the header
+            if (!ranged) {
+                fill_cache(R, &st, gen);
+            } else if (!in_cache && cache_enabled()) { // don't push the bytes out
+                R->hit = cache_hold(fn, fd, &st, gen);
+            }
+            if (wants_gzip(R, &st)) {
+                use_variant(R, &st);
+            }
+            validate(R, &st);
+        }
+    }
+
+    // set up for put
+    // the body goes to a temp file next to the target,
+    // which only takes its place once it is complete
+    if (R->method == PUT && (R->con_len != -1 || R->coding == TE_CHUNKED)) {
+        struct stat st;
+        R->status = OK;
+        if (fstatat(root_fd, fn, &st, 0) != 0) {
+            R->status = (errno == ENOENT) ? CREATED : (errno == EACCES) ? FORBIDDEN : SERV_ERR;
+        } else if (S_ISDIR(st.st_mode) || faccessat(root_fd, fn, W_OK, AT_EACCESS) != 0) {
+            R->status = FORBIDDEN;
+        }
+        if (R->status == OK || R->status == CREATED) {
+            open_temp(R);
+        }
+    }
+
+    // a PUT that is refused leaves its body unread on the socket
+    if (R->method == PUT && R->status != OK && R->status != CREATED) {
+        R->keep_alive = false;
+    }
+}
+
+// hold_bytes()
+// reserves the body bytes a prepared request
+// is about to move: a PUT's Content-Length,
+// or the file bytes a GET sends, which for a
+// 206 is only its ranges. if that is more
+// than the server has room for right now, R
+// gets a 503 instead and lets go of its
+// target.
+static void hold_bytes(Request R) {
+    off_t n = 0;
+    if (R->method == PUT && (R->status == OK || R->status == CREATED)) {
+        n = R->con_len > 0 ? R->con_len : 0; // a chunked body's size isn't known
+    } else if (R->method == GET && R->status == OK) {
+        n = R->fcon_len;
+    } else if (R->method == GET && R->status == PARTIAL) { // only what the ranges send
+        for (int k = 0; k < R->nranges; k++) {
+            n += R->ranges[k].last - R->ranges[k].first + 1;
+        }
+    }
+    if (admit_bytes(n)) {
+        R->held = n;
+        return;
+    }
+    close_target(R);
+    R->status = UNAVAIL;
+    R->keep_alive = false; // a PUT body is left unread
+}
+
+// send_n_bytes()
+// write_n_bytes() for sockets, with flags
+// for send(2). returns n, or -1 on error.
+static ssize_t send_n_bytes(int fd, const char *buf, size_t n, int flags) {
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t w = send(fd, buf + sent, n - sent, flags | MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return -1;
+        }
+        sent += w;
+    }
+    return n;
+}
+
+// shed_connection()
+// whatever the client already sent is read
+// and thrown away first, since closing with
+// unread bytes resets the connection and
+// can take the 503 down with it.
+void shed_connection(int cfd) {
+    const Reply *r = reply(UNAVAIL);
+    struct iovec out[3] = { { (char *) r->line, r->line_len },
+        { (char *) conn_close, sizeof(conn_close) - 1 }, { (char *) r->rest, r->rest_len } };
+    struct msghdr msg = { .msg_iov = out, .msg_iovlen = 3 };
+    ssize_t n = sendmsg(cfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(cfd, SHUT_WR);
+    char sink[HEAD_SIZE];
+    ssize_t got = 0, m;
+    while (got < BUF_SIZE && (m = recv(cfd, sink, sizeof(sink), MSG_DONTWAIT)) > 0) {
+        got += m;
+    }
+    close(cfd);
+    stats_request(UNAVAIL, got, n > 0 ? n : 0);
+    uint64_t now = stats_clock();
+    alog_request("", "", UNAVAIL, got, n > 0 ? n : 0, now, now);
+}
+
+// handle_request()
+// prepares Request for being executed on
+// GET or PUT methods, or prepares them to
+// return an appropriate error response.
+// Executes the method if all goes well
+// and produces and sends a response to
+// the socket in all cases.
+void handle_request(Request R) {
+    R->waiting = wheel_clock();
+    uint64_t t = stats_clock();
+    prepare_request(R);
+    hold_bytes(R);
+    R->t_ready = stats_phase(PH_OPEN, t);
+    bool ready = (R->status == OK || R->status == CREATED);
+
+    // perform put execution before responding, and only
+    // let the file replace the target once it all came in
+    if (ready && R->method == PUT) {
+        bool whole = (R->coding == TE_CHUNKED) ? put_chunked(R) : put_ex(R) == R->con_len;
+        if (whole) {
+            commit_put(R);
+        } else if (R->status == OK || R->status == CREATED) { // a bad chunk already said why
+            R->status = SERV_ERR;
+        }
+    }
+
+    // send the whole response, or the header when a file
+    // follows, in one call. a file body comes right behind,
+    // so let the header ride in its first packet
+    if (in_memory(R)) {
+        make_hit(R);
+    } else {
+        make_response(R);
+    }
+    do {
+        int flags = (file_follows(R) && R->fend > R->foff) ? MSG_MORE : 0;
+        ssize_t n;
+        while ((n = send_out(R, flags)) != 0) {
+            if (n < 0 && errno != EINTR) {
+                R->keep_alive = false;
+                return;
+            }
+        }
+
+        // perform get execution, a range at a time
+        if (!file_follows(R) || !get_ex(R)) {
+            return;
+        }
+    } while (next_part(R));
+}
+
+// start_response()
+// builds R's response header and moves
+// the state machine on to sending it.
+static void start_response(Request R) {
+    if (R->method == PUT && R->tmp[0] != NUL && (R->status == OK || R->status == CREATED)) {
+        commit_put(R);
+    }
+    if (in_memory(R)) {
+        make_hit(R);
+    } else {
+        make_response(R);
+    }
+    R->state = ST_WRITE_HEAD;
+}
+
+// begin_request()
+// parses and prepares the full header in R's
+// buffer, and moves the state machine on to
+// reading a PUT body or sending the response.
+static void begin_request(Request R) {
+    R->waiting = wheel_clock();
+    uint64_t t = stats_phase(PH_READ, R->t_start);
+    parse_request(R);
+    t = stats_phase(PH_PARSE, t);
+    prepare_request(R);
+    hold_bytes(R);
+    R->t_ready = stats_phase(PH_OPEN, t);
+    if (R->method == PUT && (R->status == OK || R->status == CREATED)
+        && R->coding == TE_CHUNKED) { // decoded from where the header ends
+        R->state = ST_READ_CHUNKS;
+    } else if (R->method == PUT && (R->status == OK || R->status == CREATED)) {
+        // drain body bytes that came in with the header first
+        int take = R->hd_read - R->hd_eo;
+        if (take > R->con_len) {
+            take = (int) R->con_len;
+        }
+        R->body_left = R->con_len - take;
+        R->next_off = R->hd_eo + take;
+        R->state = ST_READ_BODY;
+        if (write_n_bytes(R->tfd, R->hd_raw + R->hd_eo, take) != take) {
+            R->status = SERV_ERR;
+            R->keep_alive = false; // the rest of the body is left unread
+            start_response(R);
+        }
+    } else {
+        start_response(R);
+    }
+}
+
+// step_request()
+// advances R's state machine as far as it
+// can go without blocking on R's connection.
+// R's cfd must be non-blocking. the target
+// file is still read and written normally,
+// since regular files never report EAGAIN.
+// returns STEP_READ or STEP_WRITE if R is
+// waiting on its connection, or STEP_DONE
+// once the response is out or the
+// connection has failed.
+int step_request(Request R) {
+    ssize_t n;
+    while (1) {
+        switch (R->state) {
+        case ST_READ_HEAD: { // accumulate until we see RNRN
+            if (!have_header(R)) { // a pipelined header may already be here
+                n = read_more(R);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return STEP_READ;
+                }
+                if (n <= 0) { // peer left before a full header
+                    return STEP_DONE;
+                }
+                continue;
+            }
+            begin_request(R);
+            break;
+        }
+        case ST_READ_BODY: { // sock -> pipe -> file in the kernel
+            if (R->body_left == 0) {
+                start_response(R);
+                break;
+            }
+            n = splice_in(R, R->body_left, NULL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return STEP_READ;
+            }
+            if (n < 0 && errno == EINVAL) { // these fds can't splice
+                R->state = ST_COPY_BODY;
+                break;
+            }
+            if (n < 0) {
+                R->status = SERV_ERR;
+                R->keep_alive = false;
+                start_response(R);
+                break;
+            }
+            if (n == 0) {
+                debug("PUT WRONG NUMBER OF BYTES");
+                return STEP_DONE;
+            }
+            R->body_left -= n;
+            break;
+        }
+        case ST_COPY_BODY: { // header is parsed, hd_raw is free scratch
+            if (R->body_left == 0) {
+                start_response(R);
+                break;
+            }
+            int want = R->body_left < BUF_SIZE ? (int) R->body_left : BUF_SIZE;
+            n = read(R->cfd, R->hd_raw, want);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return STEP_READ;
+            }
+            if (n <= 0) {
+                debug("PUT WRONG NUMBER OF BYTES");
+                return STEP_DONE;
+            }
+            if (write_n_bytes(R->tfd, R->hd_raw, n) != n) {
+                R->status = SERV_ERR;
+                R->keep_alive = false;
+                start_response(R);
+                break;
+            }
+            R->body_left -= n;
+            break;
+        }
+        case ST_READ_CHUNKS: // decode through hd_raw, splice big chunks
+        case ST_COPY_CHUNKS: {
+            int done = feed_chunks(R);
+            if (done != 0) { // a bad chunk has set the status
+                start_response(R);
+                break;
+            }
+            bool spliced = R->state == ST_READ_CHUNKS && big_chunk(R);
+            if (spliced) {
+                n = splice_in(R, R->ch_left, &R->woff);
+            } else {
+                R->hd_read = R->next_off = 0; // all of it was decoded
+                n = read(R->cfd, R->hd_raw, BUF_SIZE);
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return STEP_READ;
+            }
+            if (n < 0 && spliced && errno == EINVAL) { // these fds can't splice
+                R->state = ST_COPY_CHUNKS;
+                break;
+            }
+            if (n < 0 && spliced) {
+                R->status = SERV_ERR;
+                R->keep_alive = false;
+                start_response(R);
+                break;
+            }
+            if (n <= 0) {
+                debug("PUT WRONG NUMBER OF BYTES");
+                return STEP_DONE;
+            }
+            if (spliced) {
+                R->ch_left -= n;
+            } else {
+                R->hd_read = n;
+            }
+            break;
+        }
+        case ST_WRITE_HEAD: {
+            n = send_out(R, (file_follows(R) && R->fend > R->foff) ? MSG_MORE : 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return STEP_WRITE;
+            }
+            if (n < 0) {
+                return STEP_DONE;
+            }
+            if (n > 0) { // 0 means it has all gone out
+                break;
+            }
+            if (file_follows(R)) {
+                R->state = ST_SEND_FILE;
+            } else {
+                R->state = ST_DONE;
+            }
+            break;
+        }
+        case ST_SEND_FILE: { // file -> sock in the kernel
+            if (R->foff >= R->fend) {
+                R->state = next_part(R) ? ST_WRITE_HEAD : ST_DONE;
+                break;
+            }
+            n = sendfile(R->cfd, R->tfd, &R->foff, R->fend - R->foff);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return STEP_WRITE;
+            }
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                // this fd can't be sendfile'd, copy by hand from foff.
+                // park pipelined bytes at the front of hd_raw and
+                // stream the file through the space after them
+                int left = R->hd_read - R->next_off;
+                memmove(R->hd_raw, R->hd_raw + R->next_off, left);
+                R->hd_read = left;
+                R->next_off = 0;
+                R->buf_off = R->buf_len = 0;
+                R->state = ST_COPY_FILE;
+                break;
+            }
+            if (n <= 0) { // error, or the file shrank under us
+                return STEP_DONE;
+            }
+            R->sent += n;
+            break;
+        }
+        case ST_COPY_FILE: { // refill from the file, then drain to the sock
+            if (R->buf_off == R->buf_len) {
+                if (R->foff >= R->fend) {
+                    R->state = next_part(R) ? ST_WRITE_HEAD : ST_DONE;
+                    break;
+                }
+                char *scratch = R->hd_raw + R->hd_read;
+                int room = BUF_SIZE - R->hd_read;
+                int want = R->fend - R->foff < room ? (int) (R->fend - R->foff) : room;
+                n = pread(R->tfd, scratch, want, R->foff);
+                if (n <= 0) {
+                    return STEP_DONE;
+                }
+                R->foff += n;
+                R->buf_off = 0;
+                R->buf_len = n;
+            }
+            n = send(R->cfd, R->hd_raw + R->hd_read + R->buf_off, R->buf_len - R->buf_off,
+                MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return STEP_WRITE;
+            }
+            if (n < 0) {
+                return STEP_DONE;
+            }
+            R->buf_off += n;
+            R->sent += n;
+            break;
+        }
+        case ST_DONE: { // keep-alive picks the connection back up
+            if (reset_request(R)) {
+                break;
+            }
+            return STEP_DONE;
+        }
+        default: return STEP_DONE;
+        }
+    }
+}
+
+// add_transfer()
+// appends the next step of moving a body
+// between the socket and the target file to
+// ops, through the scratch buffer, with the
+// file at offset off and left bytes to go.
+// the socket op is last and takes whatever
+// the socket has, so a slow peer's progress
+// shows a few bytes at a time, and anything
+// it leaves in scratch (R->pend) goes first
+// in the next chain. to_file picks write
+// then recv over read then send. returns how
+// many ops were added.
+static int add_transfer(
+    Request R, IoOp *ops, char *scratch, size_t room, off_t off, off_t left, bool to_file) {
+    int n = 0;
+    if (to_file) {
+        if (R->pend > 0) {
+            IoOp write = { IO_WRITE, R->tfd, scratch, R->pend, off, 0 };
+            ops[n++] = write;
+        }
+        off_t need = left - (off_t) R->pend;
+        if (need > 0) {
+            IoOp recv = { IO_RECV, R->cfd, scratch, need < (off_t) room ? (size_t) need : room, 0,
+                0 };
+            ops[n++] = recv;
+        }
+        return n;
+    }
+    if (R->pend > 0) {
+        IoOp send = { IO_SEND, R->cfd, scratch + R->pend_off, R->pend, 0, 0 };
+        ops[n++] = send;
+        return n;
+    }
+    size_t len = left < (off_t) room ? (size_t) left : room;
+    IoOp read = { IO_READ, R->tfd, scratch, len, off, 0 };
+    IoOp send = { IO_SEND, R->cfd, scratch, len, 0, 0 };
+    ops[n++] = read;
+    ops[n++] = send;
+    return n;
+}
+
+// plan_request()
+// the completion-based counterpart of
+// step_request(). runs R's state machine up
+// to its next I/O and describes that I/O in
+// ops as a chain to be run in order, each
+// only if the last one moved everything it
+// asked for.
+int plan_request(Request R, IoOp *ops, char *scratch, size_t room) {
+    while (1) {
+        switch (R->state) {
+        case ST_READ_HEAD: {
+            if (have_header(R)) {
+                begin_request(R);
+                break;
+            }
+            IoOp recv = { R->ring_direct ? IO_RECV : IO_RECV_ANY, R->cfd, R->hd_raw + R->hd_read,
+                BUF_SIZE - R->hd_read, 0, 0 };
+            ops[0] = recv;
+            return 1;
+        }
+        case ST_READ_BODY:
+        case ST_COPY_BODY: { // recv -> write, through scratch
+            if (R->body_left == 0) {
+                start_response(R);
+                break;
+            }
+            return add_transfer(
+                R, ops, scratch, room, R->con_len - R->body_left, R->body_left, true);
+        }
+        case ST_READ_CHUNKS:
+        case ST_COPY_CHUNKS: { // framing through hd_raw, big chunks recv -> write
+            if (R->pend == 0 && feed_chunks(R) != 0) {
+                start_response(R);
+                break;
+            }
+            if (R->pend > 0 || big_chunk(R)) {
+                return add_transfer(R, ops, scratch, room, R->woff, R->ch_left, true);
+            }
+            R->hd_read = R->next_off = 0;
+            IoOp recv = { IO_RECV, R->cfd, R->hd_raw, BUF_SIZE, 0, 0 };
+            ops[0] = recv;
+            return 1;
+        }
+        case ST_WRITE_HEAD: { // the response, then the file's first reads and sends
+            R->ring_msg = (struct msghdr) { 0 };
+            R->ring_msg.msg_iov = R->ring_iov;
+            R->ring_msg.msg_iovlen = out_iov(R, R->ring_iov);
+            off_t len = R->resp_len - R->resp_off;
+            bool file = file_follows(R) && R->fend > R->foff;
+            IoOp head = { IO_SENDMSG, R->cfd, &R->ring_msg, len, 0,
+                MSG_WAITALL | (file ? MSG_MORE : 0) };
+            ops[0] = head;
+            off_t left = R->fend - R->foff;
+            return 1 + (file ? add_transfer(R, ops + 1, scratch, room, R->foff, left, false) : 0);
+        }
+        case ST_SEND_FILE: { // read -> send, through scratch
+            if (R->foff >= R->fend) {
+                R->state = next_part(R) ? ST_WRITE_HEAD : ST_DONE;
+                break;
+            }
+            return add_transfer(R, ops, scratch, room, R->foff, R->fend - R->foff, false);
+        }
+        case ST_DONE: {
+            if (reset_request(R)) {
+                break;
+            }
+            return 0;
+        }
+        default: return 0;
+        }
+    }
+}
+
+// complete_request()
+// feeds the results of the chain plan_request()
+// last described back into R. the first op
+// that comes up short ends the connection,
+// except a failed write to the target file,
+// which is answered with a 500 instead, and
+// a body's recv or send, which may move less.
+void complete_request(Request R, const IoOp *ops, const int *res, int n, const char *data) {
+    for (int i = 0; i < n; i++) {
+        const IoOp *op = &ops[i];
+        int r = res[i];
+        if (op->kind == IO_RECV_ANY && r == -ENOBUFS) { // retry into hd_raw
+            R->ring_direct = true;
+            return;
+        }
+        if (op->kind == IO_WRITE && r != (int) op->len) {
+            R->status = SERV_ERR;
+            R->keep_alive = false;
+            start_response(R);
+            return;
+        }
+        char *b = op->buf;
+        bool header_recv = (op->kind == IO_RECV_ANY || op->kind == IO_RECV)
+            && b >= R->hd_raw && b <= R->hd_raw + BUF_SIZE;
+        bool some = header_recv || op->kind == IO_RECV || op->kind == IO_SEND;
+        if ((some && r <= 0) || (!some && r != (int) op->len)) {
+            if (op->kind == IO_RECV && !header_recv) {
+                debug("PUT WRONG NUMBER OF BYTES");
+            }
+            R->keep_alive = false;
+            R->state = ST_DONE;
+            return;
+        }
+        switch (op->kind) {
+        case IO_RECV_ANY: memcpy(R->hd_raw + R->hd_read, data, r); // fall through
+        case IO_RECV:
+            if (header_recv) {
+                if (R->t_start == 0) {
+                    R->t_start = stats_clock();
+                }
+                R->hd_read += r;
+                stringify_hd(R, R->hd_read);
+                R->ring_direct = false;
+            } else {
+                R->pend = r;
+            }
+            break;
+        case IO_WRITE:
+            if (R->coding == TE_CHUNKED) {
+                R->ch_left -= r;
+                R->woff += r;
+            } else {
+                R->body_left -= r;
+            }
+            R->pend = 0;
+            break;
+        case IO_SENDMSG:
+            R->resp_off += r;
+            R->sent += r;
+            R->state = file_follows(R) ? ST_SEND_FILE : ST_DONE;
+            break;
+        case IO_READ:
+            R->pend = r;
+            R->pend_off = 0;
+            break;
+        case IO_SEND:
+            R->foff += r;
+            R->sent += r;
+            R->pend -= r;
+            R->pend_off = R->pend > 0 ? R->pend_off + r : 0;
+            break;
+        default: break;
+        }
+    }
+}
+
+// private functions
+
+// the pipe splice_in() moves bodies through.
+// each thread gets its own, made on first
+// use, and always leaves it empty.
+static _Thread_local int body_pipe[2] = { -1, -1 };
+static _Thread_local int pipe_cap = 0; // what it holds before filling up
+
+// drop_pipe()
+// closes this thread's pipe after an error
+// left bytes stranded in it.
+static void drop_pipe(void) {
+    close(body_pipe[0]);
+    close(body_pipe[1]);
+    body_pipe[0] = body_pipe[1] = -1;
+}
+
+// splice_in()
+// moves up to n body bytes from R's connection
+// to R's target file through this thread's
+// pipe, so they never touch user memory. they
+// land at *off (which moves along) if given,
+// else at the file's own offset.
+// returns bytes moved, 0 if the peer closed,
+// or -1 with errno set. EAGAIN means the
+// (non-blocking) connection is empty, EINVAL
+// that these fds can't be spliced.
+static ssize_t splice_in(Request R, off_t n, off_t *off) {
+    if (body_pipe[0] < 0) {
+        if (pipe2(body_pipe, O_CLOEXEC) != 0) {
+            return -1;
+        }
+        fcntl(body_pipe[1], F_SETPIPE_SZ, PIPE_SIZE); // fewer trips if allowed
+        pipe_cap = fcntl(body_pipe[1], F_GETPIPE_SZ);
+    }
+
+    // the socket's own O_NONBLOCK (or SO_RCVTIMEO) decides
+    // whether this waits for bytes
+    size_t want = n < pipe_cap ? (size_t) n : (size_t) pipe_cap;
+    ssize_t in = splice(R->cfd, NULL, body_pipe[1], NULL, want, SPLICE_F_MOVE);
+    if (in <= 0) {
+        return in;
+    }
+    ssize_t left = in;
+    while (left > 0) { // the file end never says EAGAIN
+        ssize_t out = splice(body_pipe[0], NULL, R->tfd, off, left, SPLICE_F_MOVE);
+        if (out < 0 && errno == EINTR) {
+            continue;
+        }
+        if (out <= 0) {
+            int saved = errno;
+            drop_pipe();
+            errno = (out == 0 || saved == EINVAL) ? EIO : saved;
+            return -1;
+        }
+        left -= out;
+    }
+    return in;
+}
+
+// open_temp()
+// creates R's temp file in the served
+// directory, where a rename over the target
+// is atomic. '~' is never in a uri, so no
+// request can reach it. a large body of known
+// length gets its blocks reserved first, so
+// it lands in few extents and a disk that
+// can't hold it says so before it is read.
+// they are reserved past the end of the file,
+// which only grows as bytes come in, so one
+// cut short still commits nothing extra.
+// sets R's status if it can't be made.
+static void open_temp(Request R) {
+    static atomic_ulong seq = 0;
+    int fd;
+    do {
+        snprintf(R->tmp, TMP_SIZE, "~put.%d.%lu", (int) getpid(), atomic_fetch_add(&seq, 1));
+        fd = openat(root_fd, R->tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    } while (fd < 0 && errno == EEXIST); // left over from an earlier run
+    if (fd < 0) {
+        R->tmp[0] = NUL;
+        R->status = (errno == EACCES) ? FORBIDDEN : SERV_ERR;
+        return;
+    }
+    R->tfd = fd;
+    if (R->coding != TE_CHUNKED && R->con_len >= PREALLOC_MIN
+        && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, R->con_len) != 0
+        && (errno == ENOSPC || errno == EFBIG || errno == EDQUOT)) { // else it just isn't supported
+        close_target(R);
+        R->status = NO_SPACE;
+    }
+}
+
+// commit_put()
+// renames R's finished temp file over its
+// target. commits to one uri are serialized
+// by its stripe, so the last PUT to finish
+// wins, whole, and 200 vs 201 is decided
+// against what it actually replaced. GETs
+// take no lock: one that opened the old file
+// keeps reading the old file. the cache is
+// invalidated after the rename, so a GET
+// that raced it can't cache the old bytes.
+// under a durability policy the file is
+// flushed before the rename and its name
+// after, outside the stripe, and a PUT that
+// can't be flushed gets a 500.
+static void commit_put(Request R) {
+    if (durable_data(R->tfd) != 0) { // the temp file goes with R
+        R->status = SERV_ERR;
+        return;
+    }
+    pthread_mutex_t *lock = put_lock(R->fname);
+    struct stat st;
+    pthread_mutex_lock(lock);
+    bool existed = fstatat(root_fd, R->fname, &st, 0) == 0;
+    if (existed) { // the new file takes over the old one's mode
+        fchmod(R->tfd, st.st_mode & 07777);
+    }
+    if (renameat(root_fd, R->tmp, root_fd, R->fname) != 0) {
+        R->status = (errno == EISDIR || errno == EACCES) ? FORBIDDEN : SERV_ERR;
+    } else {
+        R->status = existed ? OK : CREATED;
+        R->tmp[0] = NUL;
+    }
+    cache_invalidate(R->fname);
+    if (existed && R->tmp[0] == NUL) { // the old version's variant is dead weight now
+        char key[GZKEY_SIZE];
+        gzip_key(&st, key);
+        cache_invalidate(key);
+    }
+    pthread_mutex_unlock(lock);
+    if (R->tmp[0] == NUL && durable_name() != 0) {
+        R->status = SERV_ERR;
+    }
+}
+
+// hex()
+// the value of hex digit c, or -1.
+static int hex(char c) {
+    if (is_digit(c)) {
+        return c - '0';
+    }
+    c |= 0x20; // lower case
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// feed_chunks()
+// decodes the chunked body bytes in hd_raw
+// from next_off to hd_read, writing chunk
+// data to the target file at woff as it
+// goes. state is kept between calls, so
+// bytes may come in any slices and only
+// ever take up hd_raw. stops at the end of
+// the body, leaving next_off at whatever
+// follows. returns 1 there, 0 once every
+// byte has been used and more are needed,
+// or -1 with R's status set if the framing
+// is bad or the file can't be written.
+static int feed_chunks(Request R) {
+    char *p = R->hd_raw + R->next_off, *end = R->hd_raw + R->hd_read;
+    int bad = 0;
+    while (p < end && R->ch_state != CH_DONE && bad == 0) {
+        char c = *p;
+        switch (R->ch_state) {
+        case CH_SIZE: {
+            int d = hex(c);
+            if (d >= 0 && R->ch_left <= (INT64_MAX >> 4)) {
+                R->ch_left = R->ch_left * 16 + d;
+                R->ch_digits++;
+            } else if (d >= 0 || R->ch_digits == 0) {
+                bad = BAD_REQ;
+            } else if (c == '\r') {
+                R->ch_state = CH_SIZE_LF;
+            } else if (c == ';' || c == ' ' || c == '\t') {
+                R->ch_state = CH_EXT;
+            } else {
+                bad = BAD_REQ;
+            }
+            p++;
+            break;
+        }
+        case CH_EXT:
+            bad = (c == '\n') ? BAD_REQ : 0;
+            R->ch_state = (c == '\r') ? CH_SIZE_LF : CH_EXT;
+            p++;
+            break;
+        case CH_SIZE_LF:
+            bad = (c != '\n') ? BAD_REQ : 0;
+            R->ch_state = (R->ch_left == 0) ? CH_TRAIL : CH_DATA;
+            p++;
+            break;
+        case CH_DATA: {
+            off_t n = end - p < R->ch_left ? end - p : R->ch_left;
+            for (off_t w = 0; w < n;) {
+                ssize_t put = pwrite(R->tfd, p + w, n - w, R->woff + w);
+                if (put < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (put <= 0) {
+                    bad = SERV_ERR;
+                    break;
+                }
+                w += put;
+            }
+            R->woff += n;
+            R->ch_left -= n;
+            p += n;
+            if (R->ch_left == 0) {
+                R->ch_state = CH_DATA_CR;
+            }
+            break;
+        }
+        case CH_DATA_CR:
+            bad = (c != '\r') ? BAD_REQ : 0;
+            R->ch_state = CH_DATA_LF;
+            p++;
+            break;
+        case CH_DATA_LF:
+            bad = (c != '\n') ? BAD_REQ : 0;
+            R->ch_state = CH_SIZE;
+            R->ch_digits = 0;
+            p++;
+            break;
+        case CH_TRAIL:
+            R->ch_state = (c == '\r') ? CH_TRAIL_LF : CH_TRAIL_SKIP;
+            p++;
+            break;
+        case CH_TRAIL_SKIP:
+            R->ch_state = (c == '\n') ? CH_TRAIL : CH_TRAIL_SKIP;
+            p++;
+            break;
+        case CH_TRAIL_LF:
+            bad = (c != '\n') ? BAD_REQ : 0;
+            R->ch_state = CH_DONE;
+            p++;
+            break;
+        }
+    }
+    R->next_off = p - R->hd_raw;
+    if (bad != 0) {
+        R->status = bad;
+        R->keep_alive = false;
+        return -1;
+    }
+    return R->ch_state == CH_DONE ? 1 : 0;
+}
+
+// big_chunk()
+// true if hd_raw is used up in the middle of
+// a chunk whose data is worth moving without
+// decoding it first.
+static bool big_chunk(Request R) {
+    return R->ch_state == CH_DATA && R->next_off == R->hd_read && R->ch_left >= BUF_SIZE;
+}
+
+// put_chunked()
+// put_ex() for a chunked body: decodes it as
+// it comes in, a hd_raw at a time, splicing
+// the data of big chunks straight to the
+// file. returns true once the last chunk is
+// in.
+static bool put_chunked(Request R) {
+    bool copy = false;
+    while (1) {
+        int done = feed_chunks(R);
+        if (done != 0) {
+            return done > 0;
+        }
+        bool spliced = !copy && big_chunk(R);
+        ssize_t n;
+        if (spliced) {
+            n = splice_in(R, R->ch_left, &R->woff);
+        } else {
+            R->hd_read = R->next_off = 0; // all of it was decoded
+            n = read(R->cfd, R->hd_raw, BUF_SIZE);
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && spliced && errno == EINVAL) {
+            copy = true;
+            continue;
+        }
+        if (n <= 0) { // peer gave up mid-body
+            debug("PUT WRONG NUMBER OF BYTES");
+            R->keep_alive = false;
+            return false;
+        }
+        if (spliced) {
+            R->ch_left -= n;
+        } else {
+            R->hd_read = n;
+        }
+        if (body_late(R)) { // a body trickling in forever
+            R->keep_alive = false;
+            return false;
+        }
+    }
+}
+
+// get()
+// sends the range of the target file from
+// foff to fend with sendfile(2), so the
+// bytes never leave the kernel and a range
+// starts right at its offset. fds sendfile
+// can't take are copied by hand from
+// wherever it stopped. tfd may be shared
+// through the cache, so it is only ever read
+// at explicit offsets. returns false, and
+// closes the connection, on failure.
+bool get_ex(Request R) {
+    while (R->foff < R->fend) {
+        ssize_t n = sendfile(R->cfd, R->tfd, &R->foff, R->fend - R->foff);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !body_late(R)) {
+            continue; // SO_SNDTIMEO passed with the reader stalled, but not for long enough
+        }
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            char buf[BUF_SIZE];
+            while (R->foff < R->fend) {
+                size_t want = R->fend - R->foff < BUF_SIZE ? R->fend - R->foff : BUF_SIZE;
+                n = pread(R->tfd, buf, want, R->foff);
+                if (n <= 0 || send_n_bytes(R->cfd, buf, n, 0) != n) {
+                    R->keep_alive = false;
+                    return false;
+                }
+                R->foff += n;
+                R->sent += n;
+                if (body_late(R)) {
+                    R->keep_alive = false;
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (n <= 0) { // error, or the file shrank under us
+            R->keep_alive = false;
+            return false;
+        }
+        R->sent += n;
+        if (body_late(R)) { // a reader draining it forever
+            R->keep_alive = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+// put()
+// writes the body bytes that came in with
+// the header, then splices the rest from
+// the socket to the file. fds that can't be
+// spliced are copied with pass_n_bytes().
+off_t put_ex(Request R) {
+    off_t cl = R->con_len;
+    int buf_remainder = R->hd_read - R->hd_eo;
+    ssize_t transferred = 0;
+    off_t total = 0;
+    bool copy = false;
+    if (cl > buf_remainder) { // cl large, need to read from buf AND sock case
+        R->next_off = R->hd_read; // the whole buffer was body
+        if (write_n_bytes(R->tfd, R->hd_raw + R->hd_eo, buf_remainder) != buf_remainder) {
+            R->keep_alive = false; // the rest of the body is left unread
+            R->body_left = R->con_len;
+            return 0;
+        }
+        cl -= buf_remainder;
+        total += buf_remainder;
+        R->body_left = cl;
+        while (cl > 0) {
+            // a piece at a time, so a slow body is looked at between them
+            transferred = copy ? pass_n_bytes(R->cfd, R->tfd, cl < BUF_SIZE ? cl : BUF_SIZE)
+                               : splice_in(R, cl, NULL);
+            if (transferred < 0 && !copy && errno == EINVAL) {
+                copy = true;
+                continue;
+            }
+            if (transferred < 0 && errno == EINTR) {
+                continue;
+            }
+            if (transferred <= 0) { // peer gave up mid-body
+                break;
+            }
+            cl -= transferred;
+            total += transferred;
+            R->body_left = cl;
+            if (body_late(R)) { // a body trickling in forever
+                break;
+            }
         }
     } else { // cl small, just need to read from buf case
         transferred = write_n_bytes(R->tfd, R->hd_raw + R->hd_eo, cl);
-        total += transferred;
+        total += transferred > 0 ? transferred : 0;
+        R->next_off = R->hd_eo + cl; // anything after is the next request
     }
     if (total != R->con_len) {
-        warnx("PUT WRONG NUMBER OF BYTES");
+        debug("PUT WRONG NUMBER OF BYTES");
+        R->keep_alive = false;
     }
+    R->body_left = R->con_len - total;
     return total;
 }
@@ -15,6 +15,9 @@ message parsing module~
 #include <stdio.h>
 #include <string.h>
 #include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 #define BUF_SIZE  8192
 #define HEAD_SIZE 2048
 #define RNRN      "\r\n\r\n"
@@ -26,35 +29,85 @@ typedef struct RequestObj *Request;
 enum StatusCode {
     OK = 200,
     CREATED = 201,
+    PARTIAL = 206,
+    NOT_MOD = 304,
     BAD_REQ = 400,
     FORBIDDEN = 403,
     NOT_FOUND = 404,
+    RANGE_NSAT = 416,
     SERV_ERR = 500,
     NOT_IMPD = 501,
-    VRSN_NSPD = 505
+    UNAVAIL = 503,
+    VRSN_NSPD = 505,
+    NO_SPACE = 507
 };
 
+// what a Request is waiting on after
+// step_request() returns
+enum StepResult { STEP_READ, STEP_WRITE, STEP_DONE };
+
+// one I/O a completion-based engine does on
+// a Request's behalf, see plan_request().
+// socket ops take flags for send/recv(2).
+enum IoKind {
+    IO_RECV_ANY, // recv up to len into a buffer of the engine's choosing
+    IO_RECV, // recv into buf
+    IO_SENDMSG, // sendmsg of the struct msghdr at buf, len bytes in all
+    IO_SEND, // send from buf
+    IO_READ, // read the file into buf at off
+    IO_WRITE // write buf to the file at off
+};
+
+typedef struct IoOp {
+    int kind;
+    int fd;
+    void *buf;
+    size_t len;
+    off_t off;
+    int flags;
+} IoOp;
+
+#define IO_CHAIN_MAX 3 // longest chain plan_request() makes: sendmsg, read, send
+
 // exported functs
 
 // creation/destruction
 
 // newRequest()
-// allocates a Request and initializes its
-// fields. '\0' is placed at the ends of all
-// character buffers and ints are initialized
-// to zero.
+// hands out a Request, recycled from the
+// calling thread's pool when it has one, and
+// initializes its fields. '\0' is placed at
+// the start of all character buffers and
+// ints are initialized to zero.
 Request newRequest();
 
 // freeRequest()
-// frees the dynamically allocated memory
-// associated with the Request pointed to
-// by pReq.
+// closes the target file of the Request
+// pointed to by pReq and returns it to the
+// calling thread's pool (or frees it if the
+// pool is full).
 void freeRequest(Request *pReq);
 
+// reset_request()
+// readies R for the next request on the same
+// (keep-alive) connection, carrying over any
+// bytes already read past the end of the
+// request just served. returns false if the
+// connection has to be closed instead.
+bool reset_request(Request R);
+
 // access functions
 
 char *getHeadBuf(Request R);
 
+int getCFD(Request R);
+
+// bytes of the next header already in R's
+// buffer, such as a pipelined request's.
+int getHeadLen(Request R);
+
+int getStatus(Request R);
+
 // manipulation functions
 
 // this will set the byte offset in R's
@@ -67,6 +120,32 @@ void setCFD(Request R, int fd);
 
 void setHeadLen(Request R, int hl);
 
+// closes R's connection once its current
+// request is answered, telling the client so.
+// call after parse_request().
+void dropKeepAlive(Request R);
+
+// read_header()
+// blocks until R's header buffer holds a full
+// header, reading from R's connection on top
+// of anything a previous request left there.
+// returns the number of bytes buffered, 0 if
+// the peer closed cleanly, or -1 on error or
+// once the header has taken too long, per
+// request_deadline().
+int read_header(Request R);
+
+// request_deadline()
+// when R's connection is to be given up on,
+// in wheel_clock() ns: one that sends nothing
+// gets IDLE_SECS, a header HEADER_SECS
+// however it trickles in, and a body
+// BODY_SECS plus a second per MIN_RATE bytes
+// moved, in or out (all set in parse.c). it
+// moves later as a body moves, so call again
+// at the time returned.
+uint64_t request_deadline(Request R);
+
 // parse_request()
 // will attempt to parse a valid HTTP 1.1
 // request header from the hd_buf field of
@@ -84,6 +163,21 @@ void setHeadLen(Request R, int hl);
 // error appears in the request.
 void parse_request(Request R);
 
+// parse_request_regex()
+// the original regcomp/regexec parser, with
+// the same contract as parse_request(). the
+// server no longer calls it; it is kept as a
+// reference for benchmarks and equivalence
+// checks.
+void parse_request_regex(Request R);
+
+// shed_connection()
+// answers cfd, a connection nothing has been
+// read from, with a canned 503 and closes it,
+// for when the server is too busy to take it
+// on. never blocks.
+void shed_connection(int cfd);
+
 // echo()
 // will write n bytes buf->fd (or try to).
 // returns number of bytes written or -1
@@ -91,10 +185,13 @@ void parse_request(Request R);
 int echo(int fd, char *buf, size_t n);
 
 // make_response()
-// puts an HTTP 1.1-formatted response with
-// respect to status code stat in the char
-// array pointed to by str. returns strlen
-// of response.
+// lays out R's HTTP 1.1 response for its
+// status code from prebuilt pieces, ready
+// to go out in one vectored send. for a
+// successful GET that is just the header
+// (and, for a multipart 206, the first
+// part's header). returns the length of
+// the response.
 int make_response(Request R);
 
 // handle_request()
@@ -103,7 +200,44 @@ int make_response(Request R);
 // return an appropriate error response.
 // Executes the method if all goes well
 // and produces and sends a response to
-// the socket in all cases.
+// the socket in all cases. a body that
+// misses its deadline, per request_deadline(),
+// is cut off and the connection closed.
 void handle_request(Request R);
 
+// step_request()
+// non-blocking counterpart of reading,
+// parsing and handling a request. advances
+// R as far as it can without blocking on
+// its (non-blocking) connection and returns
+// STEP_READ or STEP_WRITE if it needs to be
+// called again once the connection is
+// readable or writable, or STEP_DONE once
+// the connection can be closed.
+int step_request(Request R);
+
+// plan_request()
+// completion-based counterpart of step_request()
+// for engines that queue I/O rather than wait
+// for readiness. advances R up to its next I/O
+// and writes it to ops as a chain of at most
+// IO_CHAIN_MAX ops, to be run in order, each
+// only if the one before moved all its len
+// bytes. body transfers go through the room
+// byte scratch buffer, which can hold bytes
+// from one chain to the next, so it must stay
+// R's for as long as R's chains point into
+// it. returns the length of the chain, or 0
+// once the connection can be closed.
+int plan_request(Request R, IoOp *ops, char *scratch, size_t room);
+
+// complete_request()
+// hands R the results of the n op chain from
+// plan_request(): res[i] is what op i returned
+// (a byte count or -errno, -ECANCELED if an
+// earlier op cut the chain short). data holds
+// the bytes of an IO_RECV_ANY. call
+// plan_request() again afterwards.
+void complete_request(Request R, const IoOp *ops, const int *res, int n, const char *data);
+
 #endif
@@ -0,0 +1,150 @@
+/*
+
+joey vigil
+jovigil
+cse130
+queue.c
+~source file for the bounded
+connection queue~
+
+*/
+
+#include "queue.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+// private types
+
+/*
+the QueueObj type is a fixed-size ring buffer of connection
+file descriptors, each with the stats_clock() time it went in.
+the acceptor thread is the only producer and the worker threads
+are the consumers. head is the index of the
+next fd to pop, count is how many fds are currently queued.
+not_full and not_empty let producers and consumers sleep
+instead of spinning on the mutex.
+*/
+
+typedef struct QueueObj {
+    int *fds; // ring of queued connection fds
+    uint64_t *at; // when each went in, 0 if untimed
+    int size; // capacity of fds
+    int head; // index of next fd to dequeue
+    int count; // number of fds currently queued
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+} QueueObj;
+
+// public function defs
+
+// newQueue()
+// allocates a Queue that can hold at most
+// size connection file descriptors at once.
+Queue newQueue(int size) {
+    if (size < 1) {
+        return NULL;
+    }
+    Queue Q = malloc(sizeof(QueueObj));
+    if (Q == NULL) {
+        return NULL;
+    }
+    Q->fds = malloc(size * sizeof(int));
+    Q->at = malloc(size * sizeof(uint64_t));
+    if (Q->fds == NULL || Q->at == NULL) {
+        free(Q->fds);
+        free(Q->at);
+        free(Q);
+        return NULL;
+    }
+    Q->size = size;
+    Q->head = 0;
+    Q->count = 0;
+    pthread_mutex_init(&Q->lock, NULL);
+    pthread_cond_init(&Q->not_full, NULL);
+    pthread_cond_init(&Q->not_empty, NULL);
+    return Q;
+}
+
+// freeQueue()
+// frees the memory associated with the Queue
+// pointed to by pQ.
+void freeQueue(Queue *pQ) {
+    if (pQ != NULL && *pQ != NULL) {
+        Queue Q = *pQ;
+        pthread_mutex_destroy(&Q->lock);
+        pthread_cond_destroy(&Q->not_full);
+        pthread_cond_destroy(&Q->not_empty);
+        free(Q->fds);
+        free(Q->at);
+        free(Q);
+        *pQ = NULL;
+    }
+}
+
+// enqueue()
+// pushes fd onto the back of Q, blocking
+// while Q is full.
+void enqueue(Queue Q, int fd) {
+    uint64_t now = stats_clock();
+    pthread_mutex_lock(&Q->lock);
+    while (Q->count == Q->size) {
+        pthread_cond_wait(&Q->not_full, &Q->lock);
+    }
+    Q->fds[(Q->head + Q->count) % Q->size] = fd;
+    Q->at[(Q->head + Q->count) % Q->size] = now;
+    Q->count++;
+    pthread_cond_signal(&Q->not_empty);
+    pthread_mutex_unlock(&Q->lock);
+}
+
+// try_enqueue()
+// pushes fd onto the back of Q, or returns
+// false if Q is full.
+bool try_enqueue(Queue Q, int fd) {
+    uint64_t now = stats_clock();
+    pthread_mutex_lock(&Q->lock);
+    bool room = Q->count < Q->size;
+    if (room) {
+        Q->fds[(Q->head + Q->count) % Q->size] = fd;
+        Q->at[(Q->head + Q->count) % Q->size] = now;
+        Q->count++;
+        pthread_cond_signal(&Q->not_empty);
+    }
+    pthread_mutex_unlock(&Q->lock);
+    return room;
+}
+
+// dequeue()
+// pops the fd at the front of Q, blocking
+// while Q is empty. the time it waited is
+// taken from when it was pushed, so time the
+// pusher spent blocked on a full Q counts.
+int dequeue(Queue Q, uint64_t *waited) {
+    pthread_mutex_lock(&Q->lock);
+    while (Q->count == 0) {
+        pthread_cond_wait(&Q->not_empty, &Q->lock);
+    }
+    int fd = Q->fds[Q->head];
+    uint64_t at = Q->at[Q->head];
+    Q->head = (Q->head + 1) % Q->size;
+    Q->count--;
+    pthread_cond_signal(&Q->not_full);
+    pthread_mutex_unlock(&Q->lock);
+    if (waited != NULL) {
+        uint64_t now = at != 0 ? stats_clock() : 0;
+        *waited = now > at ? now - at : 0;
+    }
+    return fd;
+}
+
+// queue_busy()
+// a peek under the lock; it may be stale by
+// the time the caller acts on it.
+bool queue_busy(Queue Q) {
+    pthread_mutex_lock(&Q->lock);
+    bool busy = Q->count > 0;
+    pthread_mutex_unlock(&Q->lock);
+    return busy;
+}
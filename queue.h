@@ -0,0 +1,63 @@
+/*
+
+joey vigil
+jovigil
+cse130
+queue.h
+~header file for the bounded
+connection queue~
+
+*/
+
+#ifndef QUEUE_H_INCLUDE_
+#define QUEUE_H_INCLUDE_
+#include <stdbool.h>
+#include <stdint.h>
+
+// exported types
+
+typedef struct QueueObj *Queue;
+
+// exported functs
+
+// creation/destruction
+
+// newQueue()
+// allocates a Queue that can hold at most
+// size connection file descriptors at once.
+// returns NULL if size < 1 or on alloc failure.
+Queue newQueue(int size);
+
+// freeQueue()
+// frees the memory associated with the Queue
+// pointed to by pQ. any fds still queued are
+// NOT closed.
+void freeQueue(Queue *pQ);
+
+// manipulation functions
+
+// enqueue()
+// pushes fd onto the back of Q, blocking
+// while Q is full.
+void enqueue(Queue Q, int fd);
+
+// try_enqueue()
+// pushes fd onto the back of Q and returns
+// true, or returns false right away if Q is
+// full.
+bool try_enqueue(Queue Q, int fd);
+
+// dequeue()
+// pops the fd at the front of Q, blocking
+// while Q is empty. if waited isn't NULL it
+// is set to the ns fd spent in Q, or 0 if
+// stats_clock() isn't running.
+int dequeue(Queue Q, uint64_t *waited);
+
+// access functions
+
+// queue_busy()
+// true if any fds are waiting in Q.
+bool queue_busy(Queue Q);
+
+#endif
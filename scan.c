@@ -0,0 +1,241 @@
+/*
+
+joey vigil
+jovigil
+cse130
+scan.c
+~source file for the vectorized
+header scanner~
+
+*/
+
+#include "scan.h"
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+// private functions
+
+// record_pair()
+// notes a CRLF at offset q. returns true if
+// it completes the RNRN ending the header.
+static inline bool record_pair(HeaderScan *S, int q) {
+    if (S->nlines < MAX_LINES) {
+        S->crlf[S->nlines] = (unsigned short) q;
+    }
+    S->nlines++;
+    if (q == S->last + 2) {
+        S->end = q + 2;
+        S->pos = q + 2;
+        return true;
+    }
+    S->last = q;
+    return false;
+}
+
+// skip_carried_lf()
+// a CRLF can straddle two scans. its CR was
+// recorded by the first, so the second must
+// not mistake the LF for a stray byte.
+static inline void skip_carried_lf(HeaderScan *S, const char *buf) {
+    if (S->pos > 0 && buf[S->pos - 1] == '\r' && buf[S->pos] == '\n') {
+        S->pos++;
+    }
+}
+
+// scan_scalar()
+// byte at a time, for tails and old cpus.
+// looks at offsets in [S->pos, to).
+static void scan_scalar(HeaderScan *S, const char *buf, int to) {
+    skip_carried_lf(S, buf);
+    int i = S->pos;
+    while (i < to) {
+        unsigned char c = (unsigned char) buf[i];
+        if (c == '\r' && buf[i + 1] == '\n') {
+            if (record_pair(S, i)) {
+                return;
+            }
+            i += 2;
+            continue;
+        }
+        if (c < ' ' || c > '~') {
+            S->clean = false;
+        }
+        i++;
+    }
+    S->pos = i;
+}
+
+#ifdef HAVE_X86
+
+// block_result()
+// shared tail of both vector loops. pair and
+// ctrl are bitmasks over the W bytes at i of
+// CRLF starts and non-printable bytes; carry
+// is 1 if the block opens on the LF of a CRLF
+// from the block before. records the block's
+// CRLFs and returns true if one ended the
+// header.
+static inline bool block_result(
+    HeaderScan *S, int i, uint64_t pair, uint64_t ctrl, uint64_t carry) {
+    uint64_t bad = ctrl & ~pair & ~((pair << 1) | carry);
+    while (pair != 0) {
+        int b = __builtin_ctzll(pair);
+        if (record_pair(S, i + b)) {
+            // only bytes up to the final LF are header
+            if (bad & ((UINT64_C(2) << (b + 1)) - 1)) {
+                S->clean = false;
+            }
+            return true;
+        }
+        pair &= pair - 1;
+    }
+    if (bad != 0) {
+        S->clean = false;
+    }
+    return false;
+}
+
+// scan_sse2()
+// 16 bytes per step. looks at whole blocks
+// in [S->pos, to) and leaves the rest for
+// scan_scalar().
+static void scan_sse2(HeaderScan *S, const char *buf, int to) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    skip_carried_lf(S, buf);
+    int i = S->pos;
+    uint64_t carry = 0;
+    while (i + 16 <= to) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (buf + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (buf + i + 1));
+        uint64_t pair = (unsigned) _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(v0, cr), _mm_cmpeq_epi8(v1, lf)));
+        // signed compare: bytes >= 0x80 are negative, so also < ' '
+        uint64_t ctrl = (unsigned) _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmplt_epi8(v0, sp), _mm_cmpeq_epi8(v0, del)));
+        if (block_result(S, i, pair, ctrl, carry)) {
+            return;
+        }
+        carry = (pair >> 15) & 1;
+        i += 16;
+    }
+    S->pos = i;
+}
+
+// scan_avx2()
+// 32 bytes per step, otherwise scan_sse2().
+__attribute__((target("avx2"))) static void scan_avx2(HeaderScan *S, const char *buf, int to) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    skip_carried_lf(S, buf);
+    int i = S->pos;
+    uint64_t carry = 0;
+    while (i + 32 <= to) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *) (buf + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (buf + i + 1));
+        uint64_t pair = (uint32_t) _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(v0, cr), _mm256_cmpeq_epi8(v1, lf)));
+        uint64_t ctrl = (uint32_t) _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpgt_epi8(sp, v0), _mm256_cmpeq_epi8(v0, del)));
+        if (block_result(S, i, pair, ctrl, carry)) {
+            return;
+        }
+        carry = (pair >> 31) & 1;
+        i += 32;
+    }
+    S->pos = i;
+}
+
+#endif
+
+// a vector scanner, or NULL for scalar only
+typedef void (*ScanFn)(HeaderScan *S, const char *buf, int to);
+
+static ScanFn scan_blocks = NULL;
+static const char *impl_name = "scalar";
+
+// pick_impl()
+// runs before main() and picks the widest
+// scanner the cpu supports.
+__attribute__((constructor)) static void pick_impl(void) {
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_blocks = scan_avx2;
+        impl_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        scan_blocks = scan_sse2;
+        impl_name = "sse2";
+    }
+#endif
+}
+
+// public function defs
+
+// scan_reset()
+// readies S to scan a new buffer.
+void scan_reset(HeaderScan *S) {
+    S->pos = 0;
+    S->last = -10; // far enough back that q == last + 2 never holds
+    S->end = -1;
+    S->nlines = 0;
+    S->clean = true;
+}
+
+// scan_header()
+// picks up where the last call on S left off
+// and returns the offset just past RNRN, or
+// -1 if it has not arrived yet.
+int scan_header(HeaderScan *S, const char *buf, int len) {
+    if (S->end >= 0) {
+        return S->end;
+    }
+    int to = len - 1; // buf[len - 1] needs buf[len] to be final
+    if (scan_blocks != NULL) {
+        scan_blocks(S, buf, to);
+        if (S->end >= 0) {
+            return S->end;
+        }
+    }
+    scan_scalar(S, buf, to);
+    return S->end;
+}
+
+// scan_select()
+// forces the implementation scan_header()
+// uses, if the cpu can run it.
+bool scan_select(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        scan_blocks = NULL;
+        impl_name = "scalar";
+        return true;
+    }
+#ifdef HAVE_X86
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        scan_blocks = scan_sse2;
+        impl_name = "sse2";
+        return true;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        scan_blocks = scan_avx2;
+        impl_name = "avx2";
+        return true;
+    }
+#endif
+    return false;
+}
+
+// scan_impl()
+// name of the implementation in use.
+const char *scan_impl(void) {
+    return impl_name;
+}
@@ -0,0 +1,69 @@
+/*
+
+joey vigil
+jovigil
+cse130
+scan.h
+~header file for the vectorized
+header scanner~
+
+*/
+
+#ifndef SCAN_H_INCLUDE_
+#define SCAN_H_INCLUDE_
+#include <stdbool.h>
+#define MAX_LINES 256 // CRLF offsets remembered per header
+
+// exported types
+
+/*
+a HeaderScan is the scanner's progress through one header
+buffer. it is meant to live inside the object that owns the
+buffer and be fed the buffer again every time more bytes
+arrive; only bytes it has not seen yet are looked at.
+
+crlf[] holds the offset of every CRLF up to and including the
+one that ends the header, in order, so crlf[0] ends the
+request line. clean is true while every byte seen besides
+those CRLFs is printable ascii, which lets the parser skip
+checking header values byte by byte.
+*/
+
+typedef struct HeaderScan {
+    int pos; // next offset to look at
+    int last; // offset of the most recent CRLF
+    int end; // offset just past RNRN, -1 until found
+    int nlines; // CRLFs seen, may run past MAX_LINES
+    bool clean; // no stray control or non-ascii bytes yet
+    unsigned short crlf[MAX_LINES]; // offsets of the first MAX_LINES CRLFs
+} HeaderScan;
+
+// exported functs
+
+// scan_reset()
+// readies S to scan a new buffer.
+void scan_reset(HeaderScan *S);
+
+// scan_header()
+// looks at buf[S->pos, len) for CRLFs and the
+// RNRN that ends the header, and returns the
+// offset just past RNRN, or -1 if it has not
+// arrived yet. buf[len] must be readable. the
+// last byte is held back until the one after
+// it is known, and nothing past the end of
+// the header is ever looked at.
+int scan_header(HeaderScan *S, const char *buf, int len);
+
+// scan_select()
+// forces the implementation scan_header()
+// uses: "scalar", "sse2" or "avx2". returns
+// false, changing nothing, if the cpu can't
+// run it. by default the widest one the cpu
+// supports is picked at startup.
+bool scan_select(const char *name);
+
+// scan_impl()
+// name of the implementation in use.
+const char *scan_impl(void);
+
+#endif
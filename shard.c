@@ -0,0 +1,113 @@
+/*
+
+joey vigil
+jovigil
+cse130
+shard.c
+~source file for per-core
+listener sharding~
+
+*/
+
+#define _GNU_SOURCE // CPU_SET, pthread_setaffinity_np
+#include "shard.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#define BACKLOG 1024 // pending connections per listener
+
+// private functions
+
+// nth_cpu()
+// the i-th cpu in this process's affinity
+// mask, wrapping around, or -1.
+static int nth_cpu(int i) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return -1;
+    }
+    int n = CPU_COUNT(&set);
+    if (n == 0) {
+        return -1;
+    }
+    i %= n;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set) && i-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+// steer_group()
+// attaches a classic BPF program to the
+// reuseport group of fd that picks listener
+// (cpu % n). listener i sits on nth_cpu(i),
+// so this keeps a connection on the cpu its
+// packets came in on whenever the cpus this
+// process may use are 0..n-1.
+static int steer_group(int fd, int n) {
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU }, // A = cpu
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, n }, // A %= n
+        { BPF_RET | BPF_A, 0, 0, 0 }, // return A
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+// public function defs
+
+// shard_listeners()
+// opens n SO_REUSEPORT listeners on port.
+int shard_listeners(Listener_Socket *socks, int n, int port, bool steer) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    int one = 1;
+
+    for (int i = 0; i < n; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        socks[i].fd = fd;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+            return -1;
+        }
+        int cpu = nth_cpu(i);
+        if (steer && cpu >= 0) { // a hint, older kernels ignore it
+            setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+        }
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, BACKLOG) != 0) {
+            return -1;
+        }
+    }
+    if (steer && n > 1 && steer_group(socks[0].fd, n) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// shard_pin()
+// pins the calling thread to the i-th cpu
+// this process may run on.
+int shard_pin(int i) {
+    int cpu = nth_cpu(i);
+    if (cpu < 0) {
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+}
@@ -0,0 +1,39 @@
+/*
+
+joey vigil
+jovigil
+cse130
+shard.h
+~header file for per-core
+listener sharding~
+
+*/
+
+#ifndef SHARD_H_INCLUDE_
+#define SHARD_H_INCLUDE_
+#include "asgn2_helper_funcs.h"
+#include <stdbool.h>
+
+// exported functs
+
+// shard_listeners()
+// opens n listening sockets on port, bound
+// together with SO_REUSEPORT so the kernel
+// spreads new connections across them, into
+// socks[0..n). with steer, listener i is also
+// tagged with the cpu shard_pin(i) puts its
+// thread on, and the group gets a program
+// that hands each connection to the listener
+// of the cpu its packets arrived on. returns
+// 0, or -1 (with errno set) if any socket
+// can't be set up.
+int shard_listeners(Listener_Socket *socks, int n, int port, bool steer);
+
+// shard_pin()
+// pins the calling thread to the i-th cpu
+// this process may run on (wrapping around
+// if there are fewer than i+1). returns 0
+// or -1.
+int shard_pin(int i);
+
+#endif
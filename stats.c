@@ -0,0 +1,343 @@
+/*
+
+joey vigil
+jovigil
+cse130
+stats.c
+~source file for request counters,
+latency histograms and the metrics
+endpoint~
+
+*/
+
+#include "stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define SUB_BITS  4 // linear buckets per power of two, so values are kept within 1/16
+#define SUBS      (1 << SUB_BITS)
+#define TOP_BITS  40 // 2^40 ns is over 18 minutes, anything longer lands in the last bucket
+#define NBUCKETS  ((TOP_BITS - SUB_BITS + 1) * SUBS)
+#define NCODES    600 // status codes counted, by value
+#define STATS_REQ 2048 // room for a scrape's request, which is read and ignored
+
+// private types
+
+/*
+each thread that serves requests gets its own StatsObj, made on
+first use and never freed, and is the only one to write it. so
+counting is a plain load and store with no locked instruction or
+shared cache line, and the metrics thread just sums every
+thread's copy when it is scraped, reading each value whole
+(relaxed atomics) but not all of them at one instant.
+
+latency histograms are HDR style: below SUBS ns a bucket per
+value, then SUBS linear buckets for each power of two, so a
+bucket is never wider than 1/16 of the values in it and a
+quantile read off them is good to about 6%.
+*/
+
+typedef _Atomic uint64_t Count;
+
+typedef struct Hist {
+    Count buckets[NBUCKETS];
+    Count sum; // of every value, in ns
+} Hist;
+
+typedef struct StatsObj {
+    Hist phases[NPHASES];
+    Count codes[NCODES]; // requests, by status code
+    Count bytes_in;
+    Count bytes_out;
+    struct StatsObj *next; // on the list of every thread's
+} StatsObj;
+
+static bool on = false; // set once, before any worker starts
+static bool clocked = false; // stats_clock() tells the time, also set once
+static pthread_mutex_t all_lock = PTHREAD_MUTEX_INITIALIZER;
+static StatsObj *all = NULL;
+static _Thread_local StatsObj *mine = NULL;
+static int stats_fd = -1;
+
+static const char *const phase_names[NPHASES] = { "accept", "read", "parse", "open", "body",
+    "total" };
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+// private functions
+
+// bump()
+// adds by to c. only the owning thread
+// writes c, so no locked add is needed.
+static void bump(Count *c, uint64_t by) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + by,
+        memory_order_relaxed);
+}
+
+// load()
+// reads c whole.
+static uint64_t load(Count *c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+// get_mine()
+// this thread's StatsObj, made and put on
+// the list on first use. NULL if out of
+// memory.
+static StatsObj *get_mine(void) {
+    if (mine == NULL) {
+        mine = calloc(1, sizeof(StatsObj));
+        if (mine == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&all_lock);
+        mine->next = all;
+        all = mine;
+        pthread_mutex_unlock(&all_lock);
+    }
+    return mine;
+}
+
+// bucket()
+// the histogram bucket v ns falls in.
+static int bucket(uint64_t v) {
+    if (v < SUBS) {
+        return (int) v;
+    }
+    if (v >> TOP_BITS) {
+        v = (1ull << TOP_BITS) - 1;
+    }
+    int m = 63 - __builtin_clzll(v);
+    return (m - SUB_BITS + 1) * SUBS + (int) ((v >> (m - SUB_BITS)) - SUBS);
+}
+
+// bucket_top()
+// the largest value that falls in bucket i.
+static uint64_t bucket_top(int i) {
+    if (i < SUBS) {
+        return i;
+    }
+    int shift = i / SUBS - 1;
+    uint64_t low = (uint64_t) (SUBS + i % SUBS) << shift;
+    return low + (1ull << shift) - 1;
+}
+
+// collect()
+// sums every thread's StatsObj into t, which
+// must start out zeroed.
+static void collect(StatsObj *t) {
+    pthread_mutex_lock(&all_lock);
+    StatsObj *s = all;
+    pthread_mutex_unlock(&all_lock); // the list only ever grows at its head
+    for (; s != NULL; s = s->next) {
+        for (int ph = 0; ph < NPHASES; ph++) {
+            for (int i = 0; i < NBUCKETS; i++) {
+                bump(&t->phases[ph].buckets[i], load(&s->phases[ph].buckets[i]));
+            }
+            bump(&t->phases[ph].sum, load(&s->phases[ph].sum));
+        }
+        for (int c = 0; c < NCODES; c++) {
+            bump(&t->codes[c], load(&s->codes[c]));
+        }
+        bump(&t->bytes_in, load(&s->bytes_in));
+        bump(&t->bytes_out, load(&s->bytes_out));
+    }
+}
+
+// write_metrics()
+// writes the totals in t to f in the
+// Prometheus text format. phases are
+// summaries over the server's whole life.
+static void write_metrics(FILE *f, StatsObj *t) {
+    fprintf(f, "# HELP httpserver_requests_total Requests answered, by status code.\n"
+               "# TYPE httpserver_requests_total counter\n");
+    for (int c = 0; c < NCODES; c++) {
+        if (load(&t->codes[c]) > 0) {
+            fprintf(f, "httpserver_requests_total{code=\"%d\"} %llu\n", c,
+                (unsigned long long) load(&t->codes[c]));
+        }
+    }
+    fprintf(f,
+        "# HELP httpserver_received_bytes_total Request header and body bytes taken in.\n"
+        "# TYPE httpserver_received_bytes_total counter\n"
+        "httpserver_received_bytes_total %llu\n"
+        "# HELP httpserver_sent_bytes_total Response bytes sent.\n"
+        "# TYPE httpserver_sent_bytes_total counter\n"
+        "httpserver_sent_bytes_total %llu\n",
+        (unsigned long long) load(&t->bytes_in), (unsigned long long) load(&t->bytes_out));
+    fprintf(f, "# HELP httpserver_phase_seconds Time spent in each phase of a request.\n"
+               "# TYPE httpserver_phase_seconds summary\n");
+    for (int ph = 0; ph < NPHASES; ph++) {
+        Hist *h = &t->phases[ph];
+        uint64_t count = 0;
+        for (int i = 0; i < NBUCKETS; i++) {
+            count += load(&h->buckets[i]);
+        }
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            fprintf(f, "httpserver_phase_seconds{phase=\"%s\",quantile=\"%g\"} ", phase_names[ph],
+                quantiles[q]);
+            if (count == 0) {
+                fprintf(f, "NaN\n");
+                continue;
+            }
+            uint64_t rank = (uint64_t) (quantiles[q] * count + 0.999999), seen = 0;
+            int i = 0;
+            while ((seen += load(&h->buckets[i])) < rank) {
+                i++;
+            }
+            fprintf(f, "%.9f\n", bucket_top(i) / 1e9);
+        }
+        fprintf(f, "httpserver_phase_seconds_sum{phase=\"%s\"} %.9f\n", phase_names[ph],
+            load(&h->sum) / 1e9);
+        fprintf(f, "httpserver_phase_seconds_count{phase=\"%s\"} %llu\n", phase_names[ph],
+            (unsigned long long) count);
+    }
+}
+
+// send_all()
+// writes all n bytes of buf to fd, or gives
+// up on the first error.
+static void send_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, buf, n, MSG_NOSIGNAL);
+        if (w <= 0) {
+            return;
+        }
+        buf += w;
+        n -= w;
+    }
+}
+
+// serve_stats()
+// the metrics thread. answers every request
+// on stats_fd, one connection at a time,
+// with the current totals, then hangs up.
+static void *serve_stats(void *arg) {
+    (void) arg;
+    while (1) {
+        int cfd = accept(stats_fd, NULL, NULL);
+        if (cfd < 0) {
+            continue;
+        }
+        struct timeval idle = { .tv_sec = 1, .tv_usec = 0 };
+        setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+        char req[STATS_REQ + 1];
+        int got = 0;
+        ssize_t n;
+        while (got < STATS_REQ && (n = recv(cfd, req + got, STATS_REQ - got, 0)) > 0) {
+            got += n;
+            req[got] = '\0';
+            if (strstr(req, "\r\n\r\n") != NULL) {
+                break;
+            }
+        }
+
+        StatsObj *t = calloc(1, sizeof(StatsObj));
+        char *body = NULL;
+        size_t len = 0;
+        FILE *f = open_memstream(&body, &len);
+        if (t != NULL && f != NULL) {
+            collect(t);
+            write_metrics(f, t);
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        char head[160];
+        int head_len = snprintf(head, sizeof(head),
+            "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+            len);
+        send_all(cfd, head, head_len);
+        send_all(cfd, body, len);
+        free(body);
+        free(t);
+        close(cfd);
+    }
+    return NULL;
+}
+
+// public function defs
+
+// stats_init()
+bool stats_init(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // never on the wire
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return false;
+    }
+
+    stats_fd = fd;
+    on = clocked = true;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, serve_stats, NULL) != 0) {
+        on = false;
+        close(fd);
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+// stats_clock_on()
+void stats_clock_on(void) {
+    clocked = true;
+}
+
+// stats_clock()
+uint64_t stats_clock(void) {
+    if (!clocked) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// stats_phase()
+uint64_t stats_phase(int ph, uint64_t since) {
+    if (since == 0) {
+        return 0;
+    }
+    uint64_t now = stats_clock();
+    stats_took(ph, now > since ? now - since : 0);
+    return now;
+}
+
+// stats_took()
+void stats_took(int ph, uint64_t d) {
+    StatsObj *s = on ? get_mine() : NULL;
+    if (s != NULL) {
+        bump(&s->phases[ph].buckets[bucket(d)], 1);
+        bump(&s->phases[ph].sum, d);
+    }
+}
+
+// stats_request()
+void stats_request(int status, off_t in, off_t out) {
+    StatsObj *s = on ? get_mine() : NULL;
+    if (s == NULL) {
+        return;
+    }
+    if (status >= 0 && status < NCODES) {
+        bump(&s->codes[status], 1);
+    }
+    bump(&s->bytes_in, in > 0 ? in : 0);
+    bump(&s->bytes_out, out > 0 ? out : 0);
+}
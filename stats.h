@@ -0,0 +1,72 @@
+/*
+
+joey vigil
+jovigil
+cse130
+stats.h
+~header file for request counters,
+latency histograms and the metrics
+endpoint~
+
+*/
+
+#ifndef STATS_H_INCLUDE_
+#define STATS_H_INCLUDE_
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// the parts of a request that get timed
+enum Phase {
+    PH_ACCEPT, // queued between the acceptor and a worker
+    PH_READ, // from its first byte to a full header
+    PH_PARSE, // parse_request()
+    PH_OPEN, // the cache lookup or open and fstat
+    PH_BODY, // moving a PUT body in and the response out
+    PH_TOTAL, // first byte to the last of the response
+    NPHASES
+};
+
+// exported functs
+
+// stats_init()
+// turns counting on and serves the totals,
+// in the Prometheus text format, to anyone
+// who connects to port on 127.0.0.1, from a
+// thread of its own. call once, before
+// serving. returns false if the port can't
+// be bound. until it succeeds, every other
+// stats_ funct does nothing.
+bool stats_init(int port);
+
+// stats_clock_on()
+// starts stats_clock() telling the time
+// without turning counting on, for anything
+// else that times requests. call before
+// serving.
+void stats_clock_on(void);
+
+// stats_clock()
+// now, in nanoseconds, for timing a phase.
+// 0 while neither counting nor the clock is
+// on.
+uint64_t stats_clock(void);
+
+// stats_phase()
+// records ph as having run from since until
+// now, unless since is 0 (not timed) or
+// counting is off. returns now, to start the
+// next phase from, or 0 if since was.
+uint64_t stats_phase(int ph, uint64_t since);
+
+// stats_took()
+// records ph as having taken d ns, unless
+// counting is off.
+void stats_took(int ph, uint64_t d);
+
+// stats_request()
+// counts one finished request with status,
+// that took in bytes in and sent out bytes.
+void stats_request(int status, off_t in, off_t out);
+
+#endif
@@ -0,0 +1,536 @@
+/*
+
+joey vigil
+jovigil
+cse130
+uring.c
+~source file for the io_uring
+connection engine~
+
+*/
+
+#define _GNU_SOURCE // accept4 flags
+#include "uring.h"
+#include "parse.h"
+#include "shard.h"
+#include "admit.h"
+#include "wheel.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define RING_ENTRIES 1024 // submission queue slots
+#define CQ_SCALE     4 // completion slots per submission slot
+#define NBUFS        256 // provided header buffers, a power of two
+#define RBUF_SIZE    4096 // bytes per provided buffer
+#define SCRATCH      (64 * 1024) // body buffer lent to a connection mid-transfer
+#define BGID         0 // provided buffer group id
+#define ACCEPT_TAG   0 // user_data of the multishot accept
+#define TICK_TAG     1 // user_data of the timeout that wakes the ring for its wheel
+#define OP_BITS      4 // low user_data bits that index a connection's chain
+#define OP_MASK      ((1 << OP_BITS) - 1)
+
+_Static_assert(IO_CHAIN_MAX <= 1 << OP_BITS, "chain index must fit under the ConnObj pointer");
+
+// private types
+
+/*
+a RingObj is one thread's io_uring, mapped by hand with the raw
+syscalls (no liburing), plus what it lends out. the listening
+socket has a single multishot accept armed on it. every
+connection then has exactly one chain of ops in flight at a
+time, built by plan_request(): a header recv that picks one of
+the ring's provided buffers, so idle connections pin no receive
+memory, or a linked write -> recv (PUT) or sendmsg -> read ->
+send (GET) chain through a scratch buffer that is only lent to
+the connection while a body is moving. a body's recv or send
+takes what the socket has rather than waiting for all of it, so
+what it leaves in the buffer is the next chain's to finish.
+
+user_data of a connection's ops is its ConnObj pointer with the
+op's index in the chain in the low bits. when the last of the
+chain's completions is in, the results go back to
+complete_request() and the next chain is planned.
+
+deadlines are kept on a Wheel per ring, as in engine.c, with a
+timeout op armed to wake the ring once a tick while anything is
+on it. a connection out of time always has a chain in flight,
+so rather than cancel it op by op the ring shuts the socket
+down, which ends the chain and lets it close the usual way.
+*/
+
+typedef struct ConnObj {
+    Timer timer; // first, so a due Timer is its ConnObj
+    Request R;
+    IoOp ops[IO_CHAIN_MAX];
+    int res[IO_CHAIN_MAX];
+    int n; // ops in the chain in flight
+    int left; // of those, how many have yet to complete
+    int bid; // provided buffer an IO_RECV_ANY landed in, -1 if none
+    char *scratch; // lent body buffer, NULL when not transferring
+    struct ConnObj *next_free; // free list link while pooled
+} ConnObj;
+
+typedef struct Scratch {
+    struct Scratch *next;
+} Scratch;
+
+typedef struct RingObj {
+    int fd;
+    int lfd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned tail; // our copy of *sq_tail
+    unsigned unsubmitted; // sqes queued since the last enter
+    struct io_uring_buf_ring *br; // provided buffer ring
+    unsigned short br_tail;
+    char *bufs; // NBUFS * RBUF_SIZE bytes behind br
+    ConnObj *conn_pool; // idle ConnObjs
+    Scratch *scratch_pool; // idle scratch buffers
+    Wheel wheel; // connections' deadlines
+    uint64_t now; // wheel_clock() as of the last wakeup
+    struct __kernel_timespec tick; // the armed timeout's, read by the kernel
+    bool ticking; // a timeout is armed
+} RingObj;
+
+// private functions
+
+// the raw syscalls, glibc has no wrappers
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned op, void *arg, unsigned n) {
+    return (int) syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+// recycle_buf()
+// hands provided buffer bid back to the
+// kernel.
+static void recycle_buf(RingObj *r, int bid) {
+    struct io_uring_buf *b = &r->br->bufs[r->br_tail & (NBUFS - 1)];
+    b->addr = (uintptr_t) (r->bufs + (size_t) bid * RBUF_SIZE);
+    b->len = RBUF_SIZE;
+    b->bid = bid;
+    r->br_tail++;
+    __atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+// ring_init()
+// sets up r's io_uring, maps its rings and
+// registers its provided buffers. returns
+// -1 if the kernel won't have any of it.
+static int ring_init(RingObj *r, int lfd) {
+    memset(r, 0, sizeof(*r));
+    r->lfd = lfd;
+
+    // one thread submits and reaps, so the kernel needn't
+    // interrupt it to run completions; older kernels get a
+    // plain ring. (deferring that work until io_uring_enter()
+    // as well stalls linked chains between hops.)
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = RING_ENTRIES * CQ_SCALE;
+    r->fd = uring_setup(RING_ENTRIES, &p);
+    if (r->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = RING_ENTRIES * CQ_SCALE;
+        r->fd = uring_setup(RING_ENTRIES, &p);
+    }
+    if (r->fd < 0) {
+        return -1;
+    }
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && cq_len > sq_len) {
+        sq_len = cq_len;
+    }
+    char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+        IORING_OFF_SQ_RING);
+    char *cq = single ? sq
+                      : mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED) {
+        return -1;
+    }
+    r->sq_head = (unsigned *) (sq + p.sq_off.head);
+    r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *) (sq + p.sq_off.array);
+    r->cq_head = (unsigned *) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    r->sq_entries = p.sq_entries;
+    r->tail = *r->sq_tail;
+
+    // header recvs pick from these instead of pinning a buffer each
+    r->br = mmap(NULL, NBUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->bufs = malloc((size_t) NBUFS * RBUF_SIZE);
+    if (r->br == MAP_FAILED || r->bufs == NULL) {
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t) r->br;
+    reg.ring_entries = NBUFS;
+    reg.bgid = BGID;
+    if (uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < NBUFS; i++) {
+        recycle_buf(r, i);
+    }
+    r->now = wheel_clock();
+    wheel_init(&r->wheel, r->now);
+    return 0;
+}
+
+// submit()
+// tells the kernel about every queued sqe
+// and, if wait, sleeps until at least one
+// completion is in.
+static void submit(RingObj *r, bool wait) {
+    __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+    while (1) {
+        int n = uring_enter(r->fd, r->unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EBUSY)) { // reap, then try again
+            return;
+        }
+        if (n < 0) {
+            err(EXIT_FAILURE, "io_uring_enter");
+        }
+        r->unsubmitted -= n;
+        return;
+    }
+}
+
+// reserve()
+// makes room for n more sqes, submitting
+// what is queued if the ring is too full,
+// so a chain is never split across two
+// submissions.
+static void reserve(RingObj *r, unsigned n) {
+    while (r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) + n > r->sq_entries) {
+        submit(r, false);
+    }
+}
+
+// get_sqe()
+// the next free sqe, zeroed. reserve() first.
+static struct io_uring_sqe *get_sqe(RingObj *r) {
+    unsigned idx = r->tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->tail++;
+    r->unsubmitted++;
+    return sqe;
+}
+
+// arm_accept()
+// one accept that keeps completing, once per
+// connection, until the kernel drops it.
+static void arm_accept(RingObj *r) {
+    reserve(r, 1);
+    struct io_uring_sqe *sqe = get_sqe(r);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = r->lfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = ACCEPT_TAG;
+}
+
+// arm_tick()
+// a timeout that wakes the ring at the
+// wheel's next tick. it counts no other
+// completions, so only time ends it, and
+// it is armed again only once it has.
+static void arm_tick(RingObj *r) {
+    int ms = wheel_wait(&r->wheel, r->now);
+    r->tick.tv_sec = ms / 1000;
+    r->tick.tv_nsec = (long long) (ms % 1000) * 1000000;
+    reserve(r, 1);
+    struct io_uring_sqe *sqe = get_sqe(r);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uintptr_t) &r->tick;
+    sqe->len = 1; // one timespec
+    sqe->off = 0; // completions to wait for, none
+    sqe->user_data = TICK_TAG;
+    r->ticking = true;
+}
+
+// queue_chain()
+// turns c's ops into linked sqes.
+static void queue_chain(RingObj *r, ConnObj *c) {
+    reserve(r, c->n);
+    for (int i = 0; i < c->n; i++) {
+        IoOp *op = &c->ops[i];
+        struct io_uring_sqe *sqe = get_sqe(r);
+        sqe->fd = op->fd;
+        sqe->addr = (uintptr_t) op->buf;
+        sqe->len = op->len;
+        switch (op->kind) {
+        case IO_RECV_ANY:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->addr = 0;
+            sqe->flags |= IOSQE_BUFFER_SELECT;
+            sqe->buf_group = BGID;
+            sqe->msg_flags = op->flags;
+            break;
+        case IO_RECV:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->msg_flags = op->flags;
+            break;
+        case IO_SENDMSG:
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->len = 1;
+            sqe->msg_flags = op->flags | MSG_NOSIGNAL;
+            break;
+        case IO_SEND:
+            sqe->opcode = IORING_OP_SEND;
+            sqe->msg_flags = op->flags | MSG_NOSIGNAL;
+            break;
+        case IO_READ:
+            sqe->opcode = IORING_OP_READ;
+            sqe->off = op->off;
+            break;
+        case IO_WRITE:
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->off = op->off;
+            break;
+        }
+        if (i < c->n - 1) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        sqe->user_data = (uintptr_t) c | (uintptr_t) i;
+    }
+    c->left = c->n;
+}
+
+// close_conn()
+// releases everything c holds.
+static void close_conn(RingObj *r, ConnObj *c) {
+    wheel_del(&r->wheel, &c->timer);
+    close(getCFD(c->R));
+    freeRequest(&c->R);
+    c->next_free = r->conn_pool;
+    r->conn_pool = c;
+    admit_done();
+}
+
+// drive()
+// plans c's next chain and queues it, lending
+// c a scratch buffer only if the chain moves
+// a body, or closes c if it is done.
+static void drive(RingObj *r, ConnObj *c) {
+    if (c->scratch == NULL) {
+        if (r->scratch_pool != NULL) {
+            c->scratch = (char *) r->scratch_pool;
+            r->scratch_pool = r->scratch_pool->next;
+        } else if ((c->scratch = malloc(SCRATCH)) == NULL) {
+            err(EXIT_FAILURE, "malloc");
+        }
+    }
+    c->n = plan_request(c->R, c->ops, c->scratch, SCRATCH);
+    bool lent = false;
+    for (int i = 0; i < c->n; i++) {
+        char *b = c->ops[i].buf;
+        lent = lent || (b >= c->scratch && b < c->scratch + SCRATCH);
+    }
+    if (!lent) {
+        Scratch *s = (Scratch *) c->scratch;
+        s->next = r->scratch_pool;
+        r->scratch_pool = s;
+        c->scratch = NULL;
+    }
+    if (c->n == 0) {
+        close_conn(r, c);
+    } else {
+        wheel_sooner(&r->wheel, &c->timer, request_deadline(c->R));
+        queue_chain(r, c);
+    }
+}
+
+// new_conn()
+// takes on freshly accepted connection cfd.
+static void new_conn(RingObj *r, int cfd) {
+    if (!admit_conn()) {
+        shed_connection(cfd);
+        return;
+    }
+    ConnObj *c = r->conn_pool;
+    if (c != NULL) {
+        r->conn_pool = c->next_free;
+    } else if (posix_memalign((void **) &c, 1 << OP_BITS, sizeof(ConnObj)) != 0) {
+        warnx("Cannot allocate connection");
+        close(cfd);
+        admit_done();
+        return;
+    }
+    c->R = newRequest();
+    setCFD(c->R, cfd);
+    c->bid = -1;
+    c->scratch = NULL;
+    wheel_add(&r->wheel, &c->timer, request_deadline(c->R));
+    drive(r, c);
+}
+
+// reap()
+// shuts down every connection whose deadline
+// has passed, and puts the ones that came
+// due but have moved on since back on the
+// wheel for their next.
+static void reap(RingObj *r) {
+    Timer *t = wheel_expire(&r->wheel, r->now);
+    while (t != NULL) {
+        ConnObj *c = (ConnObj *) t;
+        t = t->next;
+        uint64_t due = request_deadline(c->R);
+        if (due <= r->now) {
+            shutdown(getCFD(c->R), SHUT_RDWR);
+        } else {
+            wheel_add(&r->wheel, &c->timer, due);
+        }
+    }
+}
+
+// on_cqe()
+// handles one completion.
+static void on_cqe(RingObj *r, uint64_t ud, int res, unsigned flags) {
+    if (ud == ACCEPT_TAG) {
+        if (res >= 0) {
+            new_conn(r, res);
+        } else {
+            errno = -res;
+            warn("accept");
+        }
+        if (!(flags & IORING_CQE_F_MORE)) {
+            arm_accept(r);
+        }
+        return;
+    }
+    if (ud == TICK_TAG) {
+        r->ticking = false;
+        return;
+    }
+    ConnObj *c = (ConnObj *) (uintptr_t) (ud & ~(uint64_t) OP_MASK);
+    c->res[ud & OP_MASK] = res;
+    if (flags & IORING_CQE_F_BUFFER) {
+        c->bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    }
+    if (--c->left > 0) {
+        return;
+    }
+    const char *data = c->bid >= 0 ? r->bufs + (size_t) c->bid * RBUF_SIZE : NULL;
+    complete_request(c->R, c->ops, c->res, c->n, data);
+    if (c->bid >= 0) {
+        recycle_buf(r, c->bid);
+        c->bid = -1;
+    }
+    drive(r, c);
+}
+
+// ring_loop()
+// submits, waits, reaps, forever.
+static void ring_loop(RingObj *r) {
+    arm_accept(r);
+    while (1) {
+        if (!r->ticking && r->wheel.count > 0) {
+            arm_tick(r);
+        }
+        submit(r, true);
+        r->now = wheel_clock();
+        unsigned head = *r->cq_head;
+        while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            uint64_t ud = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+            on_cqe(r, ud, res, flags);
+        }
+        reap(r);
+    }
+}
+
+typedef struct RingArgs {
+    int lfd; // listening socket, shared unless sharded
+    int shard; // cpu index this ring is pinned to, -1 if not
+} RingArgs;
+
+// ring_thread()
+// body of each extra ring thread.
+static void *ring_thread(void *arg) {
+    RingArgs *a = (RingArgs *) arg;
+    if (a->shard >= 0 && shard_pin(a->shard) != 0) {
+        warnx("Cannot pin ring %d", a->shard);
+    }
+    RingObj r;
+    if (ring_init(&r, a->lfd) != 0) {
+        err(EXIT_FAILURE, "io_uring");
+    }
+    ring_loop(&r);
+    return NULL;
+}
+
+// public function defs
+
+// run_uring()
+// serves every connection accepted on socks
+// with rings io_uring threads.
+int run_uring(Listener_Socket *socks, int rings, bool sharded) {
+    RingArgs *a = calloc(rings, sizeof(RingArgs));
+    if (a == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < rings; i++) {
+        a[i].lfd = socks[sharded ? i : 0].fd;
+        a[i].shard = sharded ? i : -1;
+    }
+
+    // this thread's ring doubles as the check that io_uring works
+    static RingObj r;
+    if (ring_init(&r, a[rings - 1].lfd) != 0) {
+        warn("io_uring");
+        return -1;
+    }
+    for (int i = 0; i < rings - 1; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, ring_thread, &a[i]) != 0) {
+            warnx("Cannot create ring thread");
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    if (sharded && shard_pin(rings - 1) != 0) { // after the others copied our cpu mask
+        warnx("Cannot pin ring %d", rings - 1);
+    }
+    ring_loop(&r);
+    return -1;
+}
@@ -0,0 +1,32 @@
+/*
+
+joey vigil
+jovigil
+cse130
+uring.h
+~header file for the io_uring
+connection engine~
+
+*/
+
+#ifndef URING_H_INCLUDE_
+#define URING_H_INCLUDE_
+#include "asgn2_helper_funcs.h"
+#include <stdbool.h>
+
+// exported functs
+
+// run_uring()
+// serves every connection accepted on socks
+// with rings threads, each driving its own
+// io_uring. a connection is owned by the ring
+// that accepted it for its whole life, and its
+// socket and file I/O is queued as linked
+// chains, so one thread keeps many requests
+// in flight on few syscalls. rings share
+// socks[0] unless sharded, as in run_engine().
+// only returns (with -1) if setup fails, e.g.
+// on a kernel without io_uring.
+int run_uring(Listener_Socket *socks, int rings, bool sharded);
+
+#endif
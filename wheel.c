@@ -0,0 +1,172 @@
+/*
+
+joey vigil
+jovigil
+cse130
+wheel.c
+~source file for the
+connection timing wheel~
+
+*/
+
+#include "wheel.h"
+#include <time.h>
+
+#define MASK (WHEEL_SLOTS - 1)
+
+// private types
+
+/*
+a hierarchical timing wheel, as in Varghese and Lauck. level 0
+has a slot per tick for the next WHEEL_SLOTS ticks, and each
+level above has a slot per whole turn of the one below. a Timer
+goes in the lowest level whose span covers it, at the slot its
+due tick's bits for that level pick, so adding or removing one
+is a list splice. when level 0 comes back round to slot 0, the
+next slot of level 1 is due to be looked at, so its Timers are
+put back in, which drops each to a lower level, and so on up.
+a Timer moves down at most WHEEL_LEVELS - 1 times before it
+expires, so every deadline costs O(1) however many there are.
+
+deadlines that are further out than the top level spans are
+parked as far out as it goes, and come due early. the wheel
+only says when to look again; whoever owns the Timer decides
+whether it has really expired.
+*/
+
+// private functions
+
+// tick_of()
+// the tick ns falls in.
+static uint64_t tick_of(uint64_t ns) {
+    return ns >> TICK_SHIFT;
+}
+
+// push()
+// splices t onto the end of the list at head.
+static void push(Timer *head, Timer *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+// place()
+// puts t on w in the slot for its tick.
+static void place(Wheel *w, Timer *t) {
+    uint64_t delta = t->tick - w->tick;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1)) != 0) {
+        level++;
+    }
+    push(&w->slots[level][(t->tick >> (WHEEL_BITS * level)) & MASK], t);
+}
+
+// public function defs
+
+// wheel_clock()
+uint64_t wheel_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// wheel_init()
+void wheel_init(Wheel *w, uint64_t now) {
+    w->tick = tick_of(now);
+    w->count = 0;
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int s = 0; s < WHEEL_SLOTS; s++) {
+            w->slots[l][s].next = w->slots[l][s].prev = &w->slots[l][s];
+        }
+    }
+}
+
+// wheel_add()
+void wheel_add(Wheel *w, Timer *t, uint64_t when) {
+    uint64_t top = w->tick + ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    uint64_t tick = tick_of(when) + 1; // never early, at most a tick late
+    if (tick <= w->tick) {
+        tick = w->tick + 1;
+    }
+    t->tick = tick > top ? top : tick;
+    place(w, t);
+    w->count++;
+}
+
+// wheel_del()
+void wheel_del(Wheel *w, Timer *t) {
+    if (t->prev == NULL) {
+        return;
+    }
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = NULL;
+    w->count--;
+}
+
+// wheel_sooner()
+// a deadline that only moves later costs
+// nothing until its Timer comes due, so
+// only one moving sooner is respliced.
+void wheel_sooner(Wheel *w, Timer *t, uint64_t when) {
+    if (t->prev != NULL && tick_of(when) + 1 < t->tick) {
+        wheel_del(w, t);
+        wheel_add(w, t, when);
+    }
+}
+
+// wheel_expire()
+// an empty wheel just jumps to now, so a
+// loop that has been idle a long time
+// doesn't walk every tick it slept through.
+Timer *wheel_expire(Wheel *w, uint64_t now) {
+    uint64_t to = tick_of(now);
+    Timer *due = NULL;
+    while (w->tick < to) {
+        if (w->count == 0) {
+            w->tick = to;
+            break;
+        }
+        w->tick++;
+
+        // put back the slot of each level that just came up,
+        // highest first, so nothing lands in a slot already done
+        int top = 0;
+        while (top < WHEEL_LEVELS - 1 && (w->tick & MASK << (WHEEL_BITS * top)) == 0) {
+            top++;
+        }
+        for (int l = top; l > 0; l--) {
+            Timer *head = &w->slots[l][(w->tick >> (WHEEL_BITS * l)) & MASK];
+            Timer *t = head->next;
+            head->next = head->prev = head;
+            while (t != head) {
+                Timer *next = t->next;
+                place(w, t);
+                t = next;
+            }
+        }
+
+        Timer *head = &w->slots[0][w->tick & MASK];
+        Timer *t = head->next;
+        head->next = head->prev = head;
+        while (t != head) {
+            Timer *next = t->next;
+            t->prev = NULL;
+            t->next = due;
+            due = t;
+            w->count--;
+            t = next;
+        }
+    }
+    return due;
+}
+
+// wheel_wait()
+int wheel_wait(Wheel *w, uint64_t now) {
+    if (w->count == 0) {
+        return -1;
+    }
+    uint64_t next = (w->tick + 1) << TICK_SHIFT;
+    return next > now ? (int) ((next - now + 999999) / 1000000) : 0;
+}
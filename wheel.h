@@ -0,0 +1,78 @@
+/*
+
+joey vigil
+jovigil
+cse130
+wheel.h
+~header file for the
+connection timing wheel~
+
+*/
+
+#ifndef WHEEL_H_INCLUDE_
+#define WHEEL_H_INCLUDE_
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WHEEL_BITS   6 // slots per level, as a power of two
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 // 2^24 ticks in all, about 26 days
+#define TICK_SHIFT   27 // a tick is 2^27 ns, about 134ms
+
+// exported types
+
+// one deadline, kept inside whatever it
+// belongs to. prev is NULL while it isn't
+// on a wheel.
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer *prev;
+    uint64_t tick; // the tick it is due at
+} Timer;
+
+// a loop's deadlines. each slot is the
+// head of a circular list of Timers.
+typedef struct Wheel {
+    uint64_t tick; // the last tick expired
+    int count; // Timers on the wheel
+    Timer slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} Wheel;
+
+// exported functs
+
+// wheel_clock()
+// now, in ns, from the coarse monotonic
+// clock, which costs no syscall to read.
+uint64_t wheel_clock(void);
+
+// wheel_init()
+// empties w and starts it at now.
+void wheel_init(Wheel *w, uint64_t now);
+
+// wheel_add()
+// puts t, which must not be on a wheel, on
+// w to come due at when (ns), rounded up to
+// the next tick.
+void wheel_add(Wheel *w, Timer *t, uint64_t when);
+
+// wheel_del()
+// takes t off w, if it is on it.
+void wheel_del(Wheel *w, Timer *t);
+
+// wheel_sooner()
+// moves t, which is on w, to come due at
+// when instead, if that is a sooner tick.
+void wheel_sooner(Wheel *w, Timer *t, uint64_t when);
+
+// wheel_expire()
+// moves w up to now and takes off every
+// Timer that came due on the way. returns
+// them as a list linked through next.
+Timer *wheel_expire(Wheel *w, uint64_t now);
+
+// wheel_wait()
+// ms until w's next tick, for a poll
+// timeout, or -1 if nothing is on it.
+int wheel_wait(Wheel *w, uint64_t now);
+
+#endif